@@ -0,0 +1,268 @@
+#ifdef ALLOC_STATS
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+
+/*
+ * malloc and friends are replaced by wrappers around the glibc
+ * implementations. GLib allocates through them, so g_new(), g_strdup() and
+ * the rest are all seen. The call site of an allocation is the innermost
+ * frame of the backtrace that lies in chooser itself, so an allocation
+ * made by g_strdup_printf() in get_prefix() is booked to get_prefix().
+ */
+
+extern void* __libc_malloc(size_t);
+extern void* __libc_calloc(size_t, size_t);
+extern void* __libc_realloc(void*, size_t);
+extern void* __libc_memalign(size_t, size_t);
+extern void  __libc_free(void*);
+
+extern char __executable_start;
+extern char etext;
+
+#define MAX_PHASES  16
+#define MAX_SITES   512
+#define MAX_FRAMES  12
+#define REPORT_SITES 10
+
+typedef struct
+{
+    gpointer addr;
+    guint64  count;
+    guint64  bytes;
+} site_t;
+
+typedef struct
+{
+    const gchar* name;
+    guint64      entered;
+    guint64      allocs;
+    guint64      frees;
+    guint64      allocated;
+    guint64      freed;
+    gint64       peak;
+    site_t       sites[MAX_SITES];
+    site_t       other;
+} phase_t;
+
+static gboolean ready;
+static GMutex   lock;
+static phase_t  phases[MAX_PHASES] = { { .name = "start" } };
+static gint     nphases = 1;
+static gint64   live;
+static gint64   peak;
+
+/*the phase of this thread, and a guard against counting our own work*/
+static __thread gint     current;
+static __thread gboolean busy;
+
+G_GNUC_NO_INLINE static gpointer call_site(void)
+{
+    if (!ready)
+        return NULL;
+    void* frames[MAX_FRAMES];
+    gint  n = backtrace(frames, MAX_FRAMES);
+    /*skip this function, book_alloc() and the wrapper*/
+    for (gint i = 3; i < n; i++)
+        if ((gchar*) frames[i] >= &__executable_start && (gchar*) frames[i] < &etext)
+            return frames[i];
+    return NULL;
+}
+
+G_GNUC_NO_INLINE static void book_alloc(gpointer p)
+{
+    if (!p || busy)
+        return;
+    busy = TRUE;
+    gsize    size = malloc_usable_size(p);
+    gpointer addr = call_site();
+
+    g_mutex_lock(&lock);
+    phase_t* ph = &phases[current];
+    ph->allocs++;
+    ph->allocated += size;
+    live += size;
+    if (live > peak)
+        peak = live;
+    if (live > ph->peak)
+        ph->peak = live;
+
+    site_t* site = &ph->other;
+    guint   h    = (GPOINTER_TO_SIZE(addr) >> 2) % MAX_SITES;
+    for (guint i = 0; i < MAX_SITES; i++)
+    {
+        site_t* s = &ph->sites[(h + i) % MAX_SITES];
+        if (s->addr == addr || s->count == 0)
+        {
+            s->addr = addr;
+            site = s;
+            break;
+        }
+    }
+    site->count++;
+    site->bytes += size;
+    g_mutex_unlock(&lock);
+    busy = FALSE;
+}
+
+static void book_free(gpointer p)
+{
+    if (!p || busy)
+        return;
+    gsize size = malloc_usable_size(p);
+    g_mutex_lock(&lock);
+    phases[current].frees++;
+    phases[current].freed += size;
+    live -= size;
+    g_mutex_unlock(&lock);
+}
+
+void* malloc(size_t size)
+{
+    void* p = __libc_malloc(size);
+    book_alloc(p);
+    return p;
+}
+
+void* calloc(size_t n, size_t size)
+{
+    void* p = __libc_calloc(n, size);
+    book_alloc(p);
+    return p;
+}
+
+void* realloc(void* old, size_t size)
+{
+    book_free(old);
+    void* p = __libc_realloc(old, size);
+    book_alloc(p);
+    return p;
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    void* p = __libc_memalign(alignment, size);
+    book_alloc(p);
+    return p;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    void* p = __libc_memalign(alignment, size);
+    book_alloc(p);
+    return p;
+}
+
+int posix_memalign(void** p, size_t alignment, size_t size)
+{
+    *p = __libc_memalign(alignment, size);
+    book_alloc(*p);
+    return *p ? 0 : ENOMEM;
+}
+
+void free(void* p)
+{
+    book_free(p);
+    __libc_free(p);
+}
+
+static gint by_bytes(gconstpointer a, gconstpointer b)
+{
+    const site_t* x = a;
+    const site_t* y = b;
+    return x->bytes < y->bytes ? 1 : x->bytes > y->bytes ? -1 : 0;
+}
+
+static void print_site(FILE* f, const site_t* s)
+{
+    Dl_info info;
+    if (!s->addr)
+        fprintf(f, "      %-32s", "(outside chooser)");
+    else if (dladdr(s->addr, &info) && info.dli_sname)
+        fprintf(f, "      %-24s+%#-7tx", info.dli_sname, (gchar*) s->addr - (gchar*) info.dli_saddr);
+    else
+        fprintf(f, "      chooser+%#-20tx", (gchar*) s->addr - &__executable_start);
+    fprintf(f, " %10" G_GUINT64_FORMAT " allocs %12" G_GUINT64_FORMAT " bytes\n", s->count, s->bytes);
+}
+
+static void report(void)
+{
+    busy = TRUE;
+    const gchar* path = getenv("CHOOSER_ALLOC_STATS");
+    FILE* f = path ? fopen(path, "w") : stderr;
+    if (!f)
+        f = stderr;
+
+    g_mutex_lock(&lock);
+    fprintf(f, "allocation stats: live %" G_GINT64_FORMAT " bytes, peak %" G_GINT64_FORMAT " bytes\n", live, peak);
+    for (gint i = 0; i < nphases; i++)
+    {
+        phase_t* ph = &phases[i];
+        fprintf(f, "  %-8s entered %" G_GUINT64_FORMAT ": %" G_GUINT64_FORMAT " allocs (%" G_GUINT64_FORMAT " bytes), %"
+                G_GUINT64_FORMAT " frees (%" G_GUINT64_FORMAT " bytes), peak live %" G_GINT64_FORMAT " bytes\n",
+                ph->name, ph->entered, ph->allocs, ph->allocated, ph->frees, ph->freed, ph->peak);
+        qsort(ph->sites, MAX_SITES, sizeof(site_t), by_bytes);
+        for (gint j = 0; j < REPORT_SITES && ph->sites[j].count; j++)
+            print_site(f, &ph->sites[j]);
+        if (ph->other.count)
+        {
+            ph->other.addr = NULL;
+            fprintf(f, "      %-32s %10" G_GUINT64_FORMAT " allocs %12" G_GUINT64_FORMAT " bytes\n",
+                    "(sites table full)", ph->other.count, ph->other.bytes);
+        }
+    }
+    g_mutex_unlock(&lock);
+    if (f != stderr)
+        fclose(f);
+}
+
+/* Allocations made before this runs are counted without a call site:
+ * backtrace() loads its unwinder, and so allocates, when first called. */
+__attribute__((constructor)) static void alloc_init(void)
+{
+    void* frame;
+    busy = TRUE;
+    backtrace(&frame, 1);
+    atexit(report);
+    busy  = FALSE;
+    ready = TRUE;
+}
+
+/* Make the calling thread's allocations count towards the phase name,
+ * which is created on first use. Phases are told apart by name. Returns
+ * the phase that was in effect. */
+gint alloc_phase(const gchar* name)
+{
+    gint previous = current;
+    busy = TRUE;
+    g_mutex_lock(&lock);
+    gint i;
+    for (i = 0; i < nphases && strcmp(phases[i].name, name); i++);
+    if (i == nphases && nphases < MAX_PHASES)
+        phases[nphases++].name = name;
+    if (i < nphases)
+    {
+        current = i;
+        phases[i].entered++;
+    }
+    g_mutex_unlock(&lock);
+    busy = FALSE;
+    return previous;
+}
+
+/* Go back to a phase returned by alloc_phase(), without counting it as
+ * entered again. */
+void alloc_restore(gint phase)
+{
+    current = phase;
+}
+
+#endif
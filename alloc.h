@@ -0,0 +1,21 @@
+#pragma once
+
+#include "conf.h"
+
+/*
+ * Allocation accounting, built with `make ALLOC_STATS=1'. Allocations are
+ * counted per phase of the calling thread and per call site, and a report
+ * goes to stderr, or to the file named by $CHOOSER_ALLOC_STATS, on exit.
+ * alloc_phase() returns the phase it replaces; code that runs inside
+ * another phase, such as a regrid in the middle of a key, hands it back
+ * to alloc_restore() when done. Without ALLOC_STATS the calls compile to
+ * nothing.
+ */
+
+#ifdef ALLOC_STATS
+gint alloc_phase(const gchar*);
+void alloc_restore(gint);
+#else
+static inline gint alloc_phase(G_GNUC_UNUSED const gchar* name) { return 0; }
+static inline void alloc_restore(G_GNUC_UNUSED gint phase) { }
+#endif
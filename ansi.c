@@ -0,0 +1,318 @@
+#include <string.h>
+
+#include "ansi.h"
+#include "curses.h"
+#include "util.h"
+
+/*
+ * --ansi: escape sequences are taken out of the lines as they are read,
+ * and the SGR ones (ESC [ ... m) are kept as attribute runs. The text
+ * without them is what is measured, searched and shown; the original
+ * bytes are still what is output.
+ *
+ * A style packs the foreground and background (0-255, or DEFAULT) and
+ * the attribute flags into 32 bits. The runs of a line are, like its
+ * fields, one guint32 array: their count, then (column, style) pairs,
+ * each run lasting to the next. Lines without SGR have none.
+ */
+
+#define DEFAULT   256
+#define FG(s)     ((s) & 0x1ff)
+#define BG(s)     (((s) >> 9) & 0x1ff)
+#define BOLD      (1u << 18)
+#define DIM       (1u << 19)
+#define ITALIC    (1u << 20)
+#define UNDERLINE (1u << 21)
+#define BLINK     (1u << 22)
+#define REVERSE   (1u << 23)
+#define PLAIN     (DEFAULT | DEFAULT << 9)
+
+#define ESC '\x1b'
+
+/*color pair of each (fg, bg) met, made as they are*/
+static GHashTable* pairs;
+static gint        next_pair = ANSIPAIR;
+
+void ansi_init(void)
+{
+    if (!conf.ansi)
+        return;
+    if (conf.raw)
+        fatal("--ansi and --raw can't be used together");
+    /*the cache keeps no runs*/
+    conf.cache = FALSE;
+}
+
+static inline guint32 with_fg(guint32 style, guint c)
+{
+    return (style & ~0x1ffu) | c;
+}
+
+static inline guint32 with_bg(guint32 style, guint c)
+{
+    return (style & ~(0x1ffu << 9)) | c << 9;
+}
+
+/* The color of 38;5;N or 38;2;R;G;B at params[*i] (just after 38), or
+ * DEFAULT. Moves *i past it. */
+static guint extended_color(const guint* params, guint n, guint* i)
+{
+    if (*i < n && params[*i] == 5 && *i + 1 < n)
+    {
+        *i += 2;
+        return MIN(params[*i - 1], 255);
+    }
+    if (*i < n && params[*i] == 2 && *i + 3 < n)
+    {
+        /*to the nearest of the 6x6x6 cube*/
+        guint r = (MIN(params[*i + 1], 255) * 5 + 127) / 255;
+        guint g = (MIN(params[*i + 2], 255) * 5 + 127) / 255;
+        guint b = (MIN(params[*i + 3], 255) * 5 + 127) / 255;
+        *i += 4;
+        return 16 + 36 * r + 6 * g + b;
+    }
+    *i = n;
+    return DEFAULT;
+}
+
+static guint32 apply_sgr(guint32 style, const guint* params, guint n)
+{
+    if (n == 0)
+        return PLAIN;
+    for (guint i = 0; i < n; )
+    {
+        guint p = params[i++];
+        if (p == 0)
+            style = PLAIN;
+        else if (p == 1)
+            style |= BOLD;
+        else if (p == 2)
+            style |= DIM;
+        else if (p == 3)
+            style |= ITALIC;
+        else if (p == 4)
+            style |= UNDERLINE;
+        else if (p == 5 || p == 6)
+            style |= BLINK;
+        else if (p == 7)
+            style |= REVERSE;
+        else if (p == 22)
+            style &= ~(BOLD | DIM);
+        else if (p == 23)
+            style &= ~ITALIC;
+        else if (p == 24)
+            style &= ~UNDERLINE;
+        else if (p == 25)
+            style &= ~BLINK;
+        else if (p == 27)
+            style &= ~REVERSE;
+        else if (p >= 30 && p <= 37)
+            style = with_fg(style, p - 30);
+        else if (p == 38)
+            style = with_fg(style, extended_color(params, n, &i));
+        else if (p == 39)
+            style = with_fg(style, DEFAULT);
+        else if (p >= 40 && p <= 47)
+            style = with_bg(style, p - 40);
+        else if (p == 48)
+            style = with_bg(style, extended_color(params, n, &i));
+        else if (p == 49)
+            style = with_bg(style, DEFAULT);
+        else if (p >= 90 && p <= 97)
+            style = with_fg(style, p - 90 + 8);
+        else if (p >= 100 && p <= 107)
+            style = with_bg(style, p - 100 + 8);
+    }
+    return style;
+}
+
+/* Bytes of the escape sequence at s, up to end. Its SGR parameters, if
+ * it is one, go to params; *n is set to their count, or -1. */
+static gsize escape_len(const gchar* s, const gchar* end, guint* params, gint* n)
+{
+    *n = -1;
+    const gchar* p = s + 1;
+    if (p >= end)
+        return 1;
+    if (*p == '[')
+    {
+        /*CSI: parameter and intermediate bytes, then a final one*/
+        const gchar* q = ++p;
+        while (q < end && (guchar) *q >= 0x30 && (guchar) *q <= 0x3f)
+            q++;
+        while (q < end && (guchar) *q >= 0x20 && (guchar) *q <= 0x2f)
+            q++;
+        if (q >= end)
+            return end - s;
+        if (*q == 'm')
+        {
+            gint  count = 0;
+            guint value = 0;
+            for (; p < q; p++)
+            {
+                if (*p >= '0' && *p <= '9')
+                    value = MIN(value * 10 + (*p - '0'), 65535u);
+                else if (*p == ';' || *p == ':')
+                {
+                    if (count < 32)
+                        params[count++] = value;
+                    value = 0;
+                }
+            }
+            if (q > s + 2 && count < 32)
+                params[count++] = value;
+            *n = count;
+        }
+        return q + 1 - s;
+    }
+    if (*p == ']' || *p == 'P' || *p == '_' || *p == '^')
+    {
+        /*OSC and other strings end with BEL or ESC \*/
+        for (const gchar* q = p + 1; q < end; q++)
+        {
+            if (*q == '\a')
+                return q + 1 - s;
+            if (*q == ESC && q + 1 < end && q[1] == '\\')
+                return q + 2 - s;
+        }
+        return end - s;
+    }
+    if ((guchar) *p >= 0x20 && (guchar) *p <= 0x2f)
+    {
+        /*nF, like ESC ( B: intermediate bytes, then a final one*/
+        const gchar* q = p;
+        while (q < end && (guchar) *q >= 0x20 && (guchar) *q <= 0x2f)
+            q++;
+        return q >= end ? end - s : q + 1 - s;
+    }
+    return 2;
+}
+
+static void add_run(GArray* runs, guint32 col, guint32 style)
+{
+    guint32* last = runs->len ? &g_array_index(runs, guint32, runs->len - 2) : NULL;
+    if (last && last[0] == col)
+    {
+        last[1] = style;
+        return;
+    }
+    guint32 prev = last ? last[1] : PLAIN;
+    if (prev == style)
+        return;
+    g_array_append_val(runs, col);
+    g_array_append_val(runs, style);
+}
+
+/* The text of gstr without escape sequences; gstr itself if it has none.
+ * *runs is set to its SGR runs, or NULL. */
+GString* ansi_strip(GString* gstr, guint32** runs)
+{
+    *runs = NULL;
+    if (!memchr(gstr->str, ESC, gstr->len))
+        return gstr;
+
+    GString*     text  = g_string_sized_new(gstr->len);
+    GArray*      found = g_array_new(FALSE, FALSE, sizeof(guint32));
+    guint32      style = PLAIN;
+    guint32      col   = 0;
+    const gchar* end   = gstr->str + gstr->len;
+    for (const gchar* s = gstr->str; s < end; )
+    {
+        if (*s == ESC)
+        {
+            guint params[32];
+            gint  n;
+            s += escape_len(s, end, params, &n);
+            if (n >= 0)
+            {
+                style = apply_sgr(style, params, n);
+                add_run(found, col, style);
+            }
+            continue;
+        }
+        const gchar* next = memchr(s, ESC, end - s);
+        if (!next)
+            next = end;
+        g_string_append_len(text, s, next - s);
+        for (const gchar* p = s; p < next && *p; )
+        {
+            gunichar c;
+            p   += utf8_decode(p, &c);
+            col += gunichar_width(c);
+        }
+        s = next;
+    }
+    /*drop a run of the plain style at the end*/
+    if (found->len && g_array_index(found, guint32, found->len - 1) == PLAIN
+        && g_array_index(found, guint32, found->len - 2) >= col)
+        g_array_set_size(found, found->len - 2);
+    if (found->len)
+    {
+        guint32* r = g_new(guint32, found->len + 1);
+        r[0]  = found->len / 2;
+        *runs = r;
+        memcpy(r + 1, found->data, found->len * sizeof(guint32));
+    }
+    g_array_free(found, TRUE);
+    return text;
+}
+
+/* A color this terminal has, near c; -1 for the default one. */
+static gshort fit_color(guint c)
+{
+    if (c == DEFAULT)
+        return -1;
+    if ((gint) c < COLORS)
+        return c;
+    if (c < 16)
+        return c - 8;
+    if (c >= 232)
+        return c >= 244 ? COLOR_WHITE : COLOR_BLACK;
+    c -= 16;
+    return (c / 36 >= 3 ? COLOR_RED : 0) | ((c / 6) % 6 >= 3 ? COLOR_GREEN : 0) | (c % 6 >= 3 ? COLOR_BLUE : 0);
+}
+
+static gint pair_of(guint32 style)
+{
+    if (!pairs)
+        pairs = g_hash_table_new(g_direct_hash, g_direct_equal);
+    guint    key  = style & 0x3ffff;
+    gpointer pair = g_hash_table_lookup(pairs, GUINT_TO_POINTER(key));
+    if (pair)
+        return GPOINTER_TO_INT(pair);
+    if (next_pair >= COLOR_PAIRS)
+        return 0;
+    init_pair(next_pair, fit_color(FG(style)), fit_color(BG(style)));
+    g_hash_table_insert(pairs, GUINT_TO_POINTER(key), GINT_TO_POINTER(next_pair));
+    return next_pair++;
+}
+
+/* The curses attributes of a style, leaving out those of base, which
+ * the line is drawn with already; its color wins over the style's. */
+attr_t ansi_attr(guint32 style, attr_t base)
+{
+    attr_t attr = 0;
+    if (style & BOLD)
+        attr |= A_BOLD;
+    if (style & DIM)
+        attr |= A_DIM;
+    if (style & ITALIC)
+        attr |= A_ITALIC;
+    if (style & UNDERLINE)
+        attr |= A_UNDERLINE;
+    if (style & BLINK)
+        attr |= A_BLINK;
+    if (style & REVERSE)
+        attr |= A_REVERSE;
+    if ((style & 0x3ffff) != PLAIN && conf.color && has_colors() && !(base & A_COLOR))
+        attr |= COLOR_PAIR(pair_of(style));
+    return attr & ~(base & ~A_COLOR);
+}
+
+/* Forget the pairs made, for the next curses session. */
+void ansi_reset(void)
+{
+    if (pairs)
+        g_hash_table_remove_all(pairs);
+    next_pair = ANSIPAIR;
+}
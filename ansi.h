@@ -0,0 +1,8 @@
+#pragma once
+
+#include "conf.h"
+
+void     ansi_init(void);
+GString* ansi_strip(GString*, guint32**);
+attr_t   ansi_attr(guint32, attr_t);
+void     ansi_reset(void);
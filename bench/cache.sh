@@ -0,0 +1,27 @@
+#!/bin/sh
+# Startup with --cache: read MB (default 1024) megabytes of paths from a
+# file without a snapshot (cold, which writes one) and with it (warm),
+# against a plain read. Snapshots go to bench/cache, which is emptied
+# first. As root the page cache is dropped before each run, so the file
+# itself is cold too. Run from the top directory after make chooser bench.
+mb=${1:-1024}
+corpus=bench/corpus-$mb.txt
+export XDG_CACHE_HOME="$PWD/bench/cache"
+if [ ! -f $corpus ]
+then
+    bench/corpus.sh $((mb * 1048576 / 24)) | head -c $((mb * 1048576)) > $corpus
+fi
+rm -rf bench/cache
+
+run()
+{
+    [ -w /proc/sys/vm/drop_caches ] && sync && echo 3 > /proc/sys/vm/drop_caches
+    bench/replay -o bench/cache.log bench/quit.keys -- ./chooser "$@" $corpus < /dev/null |
+    awk '$2 == "start" { print $3 }'
+}
+
+printf '%-8s %10s\n' run "start ms"
+printf '%-8s %10s\n' plain "$(run)"
+printf '%-8s %10s\n' cold "$(run --cache)"
+printf '%-8s %10s\n' warm "$(run --cache)"
+printf '%-8s %10s\n' warm "$(run --cache)"
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Print N (default 1000000) lines of KIND (default paths) for bench/replay:
+#   paths   path-like ASCII lines
+#   cjk     lines of CJK words, two columns a character
+#   emoji   lines of emoji, with modifiers, flags and ZWJ sequences
+awk -v n="${1:-1000000}" -v kind="${2:-paths}" 'BEGIN {
+    srand(1)
+    split("usr lib share src include doc bin local etc var", dir, " ")
+    split("東京 大阪 文字列 検索 選択 行列 日本語 中文 한국어 漢字", cjk, " ")
+    split("😀 🚀 👍🏽 🇯🇵 👨‍👩‍👧 ✨ 🔥 🎉 ⌚ 🏳️‍🌈", emoji, " ")
+    if (kind != "paths" && kind != "cjk" && kind != "emoji")
+    {
+        print "corpus.sh: unknown kind " kind > "/dev/stderr"
+        exit 1
+    }
+    for (i = 0; i < n; i++)
+    {
+        line = ""
+        for (d = int(rand() * 5) + 1; d > 0; d--)
+            if (kind == "paths")
+                line = line "/" dir[int(rand() * 10) + 1]
+            else if (kind == "cjk")
+                line = line cjk[int(rand() * 10) + 1] " "
+            else
+                line = line emoji[int(rand() * 10) + 1] " "
+        printf "%s/file%d.%s\n", line, i, (i % 3 ? "c" : "txt")
+    }
+}'
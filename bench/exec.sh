@@ -0,0 +1,19 @@
+#!/bin/sh
+# --exec: run `true' for N (default 10000) lines, one job a line, with 1, 4,
+# 8 and 16 jobs at once, and with 100 lines a job. The time is from the
+# enter key to chooser's exit. xargs -P over the same lines is timed for
+# comparison. Run from the top directory after make chooser bench.
+n=${1:-10000}
+bench/corpus.sh "$n" > bench/corpus-exec.txt || exit 1
+printf '%-22s %10s\n' run "ms"
+for opts in "-P 1" "-P 4" "-P 8" "-P 16" "-P 8 --exec-batch 100"
+do
+    bench/replay -o bench/exec.log bench/enter.keys -- ./chooser --initial --exec true $opts < bench/corpus-exec.txt |
+    awk -v run="$opts" '$2 == "exit" { printf "%-22s %10s\n", run, $3 }'
+done
+for p in 1 8
+do
+    start=$(date +%s%N)
+    xargs -d '\n' -n 1 -P $p true < bench/corpus-exec.txt
+    awk -v p=$p -v start=$start -v end=$(date +%s%N) 'BEGIN { printf "%-22s %10.1f\n", "xargs -P " p, (end - start) / 1e6 }'
+done
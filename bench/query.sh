@@ -0,0 +1,19 @@
+#!/bin/sh
+# Queries against regexes: check the lines of N (default 1000000) paths
+# that have lib and usr but not txt, by three chained regex sweeps (m, M,
+# M), by one lookahead regex and by one --query query. Prints the time
+# from each search key to its last redraw, summed over the
+# sweeps. Run from the top directory after make chooser bench.
+n=${1:-1000000}
+bench/corpus.sh "$n" > bench/corpus-query.txt || exit 1
+echo "$(grep lib bench/corpus-query.txt | grep usr | grep -vc txt) lines to check"
+printf '%-10s %10s\n' run ms
+for run in chain lookahead query
+do
+    opts=
+    [ $run = query ] && opts=--query
+    bench/replay -o bench/query.log bench/$run.keys -- ./chooser $opts < bench/corpus-query.txt |
+    awk -v run=$run '
+        $2 == "sweep" { ms += $3 }
+        END { printf "%-10s %10.1f\n", run, ms }'
+done
@@ -0,0 +1,19 @@
+#!/bin/sh
+# --raw against UTF-8 mode: load N (default 1000000) lines of paths and
+# play bench/session.keys (paging, a search, marks, a resize) in each
+# mode. Prints the time to the first screen, the load rate and the key
+# latencies. Run from the top directory after make chooser bench.
+n=${1:-1000000}
+export LC_ALL=C.UTF-8
+bench/corpus.sh "$n" > bench/corpus-raw.txt || exit 1
+bytes=$(wc -c < bench/corpus-raw.txt)
+printf '%-6s %10s %8s %10s %10s\n' mode "start ms" MB/s "p50 us" "p99 us"
+for mode in utf-8 raw
+do
+    [ $mode = raw ] && set -- --raw
+    bench/replay -o bench/raw-$mode.log bench/session.keys -- ./chooser "$@" < bench/corpus-raw.txt |
+    awk -v mode=$mode -v bytes="$bytes" '
+        $2 == "start" { ms = $3 }
+        $2 == "keys"  { p50 = $5; p99 = $9 }
+        END { printf "%-6s %10.1f %8.1f %10s %10s\n", mode, ms, bytes / 1048576 / (ms / 1000), p50, p99 }'
+done
@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+#include <glib.h>
+#include <glib/gprintf.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * Replay a key script against chooser on a pseudo-terminal of a fixed
+ * size, for end-to-end latency runs:
+ *
+ *   bench/replay [-r ROWS] [-c COLS] [-o LOG] SCRIPT -- ./chooser [OPTION...] < CORPUS
+ *
+ * chooser runs in a session of its own on the slave side, with --tty and
+ * --latency-log LOG added to its options, its input from our stdin and
+ * its output thrown away. Once it has drawn its first screen the script
+ * is played on the master side, one step per line:
+ *
+ *   rate N              send N keys a second from now on, 0 for no pause
+ *   key TEXT [COUNT]    send TEXT as one key, COUNT times
+ *   type TEXT           send each character of TEXT as a key
+ *   wait MS             pause
+ *   resize ROWS COLS    resize the terminal
+ *   time LABEL          wait until the terminal is quiet, then print the
+ *                       time from the last time step to the last byte
+ *
+ * TEXT takes C escapes: \033 for escape, \r for enter. Lines starting
+ * with # are comments. When chooser is done, the summary line of LOG
+ * (p50/p90/p99/max) is printed with the bytes the terminal received.
+ * Times are printed as `# LABEL N ms' lines: `start' for the first
+ * screen, counted from the spawn, each time step, and `exit' for the
+ * time from the last step to chooser's exit.
+ */
+
+#define QUIET_MS   200
+#define START_MS   600000
+#define EXIT_MS    10000
+
+static gint   rows     = 40;
+static gint   cols     = 120;
+static gchar* log_path = "latency.log";
+
+static gint   master;
+static gint64 received;
+/*when the last byte came, and when the last time step ended*/
+static gint64 last_byte;
+static gint64 mark;
+
+static void die(const gchar* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    g_fprintf(stderr, "replay: ");
+    g_vfprintf(stderr, fmt, ap);
+    g_fprintf(stderr, "\n");
+    va_end(ap);
+    exit(EXIT_FAILURE);
+}
+
+/* Read what chooser writes to the terminal for ms milliseconds, so it
+ * never blocks on a full pty. With quiet, stop early once nothing came
+ * for QUIET_MS. Returns FALSE when the terminal was closed. */
+static gboolean drain(gint ms, gboolean quiet)
+{
+    gint64 end  = g_get_monotonic_time() + (gint64) ms * 1000;
+    gint64 last = g_get_monotonic_time();
+    for (;;)
+    {
+        /*past due, what is already there is still read*/
+        gint64 now     = g_get_monotonic_time();
+        gint64 due     = quiet ? MIN(end, last + QUIET_MS * 1000) : end;
+        gint   timeout = now >= due ? 0 : (due - now + 999) / 1000;
+        struct pollfd pfd = { master, POLLIN, 0 };
+        gint n = poll(&pfd, 1, timeout);
+        if (n < 0 && errno != EINTR)
+            die("poll: %s", g_strerror(errno));
+        if (n <= 0 && timeout == 0)
+            return TRUE;
+        if (n <= 0)
+            continue;
+        gchar   buf[65536];
+        ssize_t got = read(master, buf, sizeof(buf));
+        if (got <= 0)
+            return FALSE;
+        received += got;
+        last      = g_get_monotonic_time();
+        last_byte = last;
+    }
+}
+
+static void send_key(const gchar* key, gsize len, gint rate)
+{
+    if (write(master, key, len) != (ssize_t) len)
+        die("write: %s", g_strerror(errno));
+    drain(rate > 0 ? 1000 / rate : 0, FALSE);
+}
+
+static void print_time(const gchar* label, gint64 until)
+{
+    g_printf("# %s %.1f ms\n", label, MAX(0, until - mark) / 1000.0);
+    mark = g_get_monotonic_time();
+}
+
+static void resize(gint r, gint c)
+{
+    struct winsize ws = { r, c, 0, 0 };
+    if (ioctl(master, TIOCSWINSZ, &ws) < 0)
+        die("can't resize: %s", g_strerror(errno));
+}
+
+static void play(const gchar* path)
+{
+    gchar*  data;
+    GError* err = NULL;
+    if (!g_file_get_contents(path, &data, NULL, &err))
+        die("can't read %s: %s", path, err->message);
+    gchar** lines = g_strsplit(data, "\n", -1);
+    gint    rate  = 0;
+    for (gint i = 0; lines[i]; i++)
+    {
+        gchar* line = g_strstrip(lines[i]);
+        if (!*line || *line == '#')
+            continue;
+        gchar** word = g_strsplit_set(line, " \t", 2);
+        gchar*  arg  = word[1] ? g_strchug(word[1]) : "";
+        if (g_str_equal(word[0], "rate"))
+            rate = atoi(arg);
+        else if (g_str_equal(word[0], "wait"))
+            drain(atoi(arg), FALSE);
+        else if (g_str_equal(word[0], "time"))
+        {
+            drain(START_MS, TRUE);
+            print_time(*arg ? arg : "time", last_byte);
+        }
+        else if (g_str_equal(word[0], "resize"))
+        {
+            gint r, c;
+            if (sscanf(arg, "%d %d", &r, &c) != 2)
+                die("%s:%d: resize ROWS COLS", path, i + 1);
+            resize(r, c);
+        }
+        else if (g_str_equal(word[0], "key") || g_str_equal(word[0], "type"))
+        {
+            gint   count = 1;
+            gchar* space = strrchr(arg, ' ');
+            if (word[0][0] == 'k' && space && (count = atoi(space + 1)) > 0)
+                *space = '\0';
+            else
+                count = 1;
+            gchar* text = g_strcompress(arg);
+            gsize  len  = strlen(text);
+            for (gint k = 0; k < count; k++)
+            {
+                if (word[0][0] == 'k')
+                    send_key(text, len, rate);
+                else
+                    for (const gchar* p = text; *p; p = g_utf8_next_char(p))
+                        send_key(p, g_utf8_next_char(p) - p, rate);
+            }
+            g_free(text);
+        }
+        else
+            die("%s:%d: unknown step `%s'", path, i + 1, word[0]);
+        g_strfreev(word);
+    }
+    g_strfreev(lines);
+    g_free(data);
+}
+
+static GPid spawn(gchar** command, gint slave)
+{
+    GPtrArray* argv = g_ptr_array_new();
+    for (gint i = 0; command[i]; i++)
+        g_ptr_array_add(argv, command[i]);
+    g_ptr_array_add(argv, "--tty");
+    g_ptr_array_add(argv, ttyname(slave));
+    g_ptr_array_add(argv, "--latency-log");
+    g_ptr_array_add(argv, log_path);
+    g_ptr_array_add(argv, NULL);
+
+    GPid pid = fork();
+    if (pid < 0)
+        die("fork: %s", g_strerror(errno));
+    if (pid == 0)
+    {
+        /*the pty is the controlling terminal, so resizes send SIGWINCH*/
+        setsid();
+        if (ioctl(slave, TIOCSCTTY, 0) < 0)
+            die("can't take the terminal: %s", g_strerror(errno));
+        close(master);
+        gint null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+        execvp(argv->pdata[0], (gchar**) argv->pdata);
+        die("can't run %s: %s", (gchar*) argv->pdata[0], g_strerror(errno));
+    }
+    g_ptr_array_free(argv, TRUE);
+    return pid;
+}
+
+static gint wait_exit(GPid pid)
+{
+    gint64 end = g_get_monotonic_time() + EXIT_MS * 1000;
+    gint   status;
+    while (waitpid(pid, &status, WNOHANG) == 0)
+    {
+        if (g_get_monotonic_time() >= end)
+        {
+            g_fprintf(stderr, "replay: chooser did not quit, killed\n");
+            kill(pid, SIGTERM);
+            waitpid(pid, &status, 0);
+            break;
+        }
+        drain(10, FALSE);
+    }
+    print_time("exit", g_get_monotonic_time());
+    return status;
+}
+
+static void report(void)
+{
+    gchar*  data;
+    GError* err = NULL;
+    if (!g_file_get_contents(log_path, &data, NULL, &err))
+        die("can't read %s: %s", log_path, err->message);
+    gchar** lines = g_strsplit(data, "\n", -1);
+    for (gint i = 0; lines[i]; i++)
+        if (lines[i][0] == '#')
+            g_printf("%s\n", lines[i]);
+    g_printf("# terminal %dx%d received %" G_GINT64_FORMAT " bytes\n", cols, rows, received);
+    g_strfreev(lines);
+    g_free(data);
+}
+
+gint main(gint argc, gchar** argv)
+{
+    GOptionEntry entries[] =
+    {
+        { "rows",    'r', 0, G_OPTION_ARG_INT,      &rows,     "terminal rows",              "N"    },
+        { "columns", 'c', 0, G_OPTION_ARG_INT,      &cols,     "terminal columns",           "N"    },
+        { "log",     'o', 0, G_OPTION_ARG_FILENAME, &log_path, "latency log of chooser",     "FILE" },
+        { NULL }
+    };
+    GError*         err = NULL;
+    GOptionContext* context = g_option_context_new("SCRIPT -- CHOOSER [OPTION...] < CORPUS");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &err))
+        die("%s", err->message);
+    g_option_context_free(context);
+    /*GLib keeps the -- when an argument after it starts with -*/
+    gchar** command = argv + 2;
+    if (argc > 2 && g_str_equal(*command, "--"))
+        command++;
+    if (argc < 3 || !*command)
+        die("usage: replay [-r ROWS] [-c COLS] [-o LOG] SCRIPT -- CHOOSER [OPTION...] < CORPUS");
+
+    gint           slave;
+    struct winsize ws = { rows, cols, 0, 0 };
+    if (openpty(&master, &slave, NULL, NULL, &ws) < 0)
+        die("openpty: %s", g_strerror(errno));
+    mark     = g_get_monotonic_time();
+    GPid pid = spawn(command, slave);
+    close(slave);
+
+    /*the first screen, however long the corpus takes to read*/
+    struct pollfd pfd = { master, POLLIN, 0 };
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR);
+    drain(START_MS, TRUE);
+    print_time("start", last_byte);
+
+    play(argv[1]);
+    gint status = wait_exit(pid);
+    drain(QUIET_MS, TRUE);
+    close(master);
+    report();
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
@@ -0,0 +1,14 @@
+#!/bin/sh
+# Pipelined reading: load N (default 5000000) lines of paths from stdin
+# with 1, 2, 4, 8 and 16 reading threads and print the time to the first
+# screen and the rate. Run from the top directory after make chooser bench.
+n=${1:-5000000}
+bench/corpus.sh "$n" > bench/corpus-threads.txt || exit 1
+bytes=$(wc -c < bench/corpus-threads.txt)
+printf '%-8s %10s %8s\n' threads "start ms" MB/s
+for threads in 1 2 4 8 16
+do
+    bench/replay -o bench/threads.log bench/quit.keys -- ./chooser --threads $threads < bench/corpus-threads.txt |
+    awk -v threads=$threads -v bytes="$bytes" '
+        $2 == "start" { printf "%-8s %10.1f %8.1f\n", threads, $3, bytes / 1048576 / ($3 / 1000) }'
+done
@@ -0,0 +1,19 @@
+#!/bin/sh
+# Width throughput: load N (default 1000000) lines of ASCII paths, CJK
+# words and emoji, then page down and across them. Every line's width is
+# taken while loading and a slice of it is drawn per row, so the load rate
+# and the key latencies follow the width code. Run from the top directory
+# after make chooser bench.
+n=${1:-1000000}
+export LC_ALL=C.UTF-8
+printf '%-6s %8s %10s %8s %10s %10s\n' kind MB "start ms" MB/s "p50 us" "p99 us"
+for kind in paths cjk emoji
+do
+    bench/corpus.sh "$n" $kind > bench/corpus-$kind.txt || exit 1
+    bytes=$(wc -c < bench/corpus-$kind.txt)
+    bench/replay -o bench/width-$kind.log bench/page.keys -- ./chooser < bench/corpus-$kind.txt |
+    awk -v kind=$kind -v bytes="$bytes" '
+        $2 == "start" { ms = $3 }
+        $2 == "keys"  { p50 = $5; p99 = $9 }
+        END { mb = bytes / 1048576; printf "%-6s %8.1f %10.1f %8.1f %10s %10s\n", kind, mb, ms, mb / (ms / 1000), p50, p99 }'
+done
@@ -0,0 +1,272 @@
+#include "cache.h"
+#include "util.h"
+#include "fields.h"
+#include "preselect.h"
+
+#include <string.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+
+/*
+ * Snapshot cache for file inputs. After a file is read, its processed lines
+ * (raw and normalized text, width, length, whiteness) are written to
+ * $XDG_CACHE_HOME/chooser/<sha1 of path>. The next run against the same
+ * unchanged file maps the snapshot and points the lines straight into it.
+ *
+ * A snapshot is used only if the file's device, inode, size, mtime and
+ * ctime, a checksum of its head and tail, the locale charset and the
+ * options that affect reading (whitelines, delimiter) all match, and
+ * every record is in bounds.
+ * Snapshots are written to a temporary file and renamed into place.
+ */
+
+#define CACHE_MAGIC   "CHOOSER"
+#define CACHE_VERSION 2
+#define CACHE_SAMPLE  (64 * 1024)
+
+typedef struct
+{
+    gchar   magic[8];
+    guint32 version;
+    guint32 whitelines;
+    guint32 delimiter;
+    guint32 reserved;
+    guint64 dev;
+    guint64 ino;
+    guint64 size;
+    gint64  mtime;
+    gint64  ctime;
+    gchar   charset[32];
+    gchar   sample[48];
+    guint64 lines;
+} cache_header_t;
+
+typedef struct
+{
+    guint64 real_offset;
+    guint64 real_len;
+    guint64 norm_offset;
+    guint64 norm_len;
+    gint64  width;
+    gint64  length;
+    guint32 white;
+    guint32 reserved;
+} cache_record_t;
+
+/*key of the file being read, taken before reading it*/
+static cache_header_t pending;
+static gboolean       pending_valid;
+
+static gchar* cache_path(const gchar* path)
+{
+    gchar* full = g_canonicalize_filename(path, NULL);
+    gchar* sum  = g_compute_checksum_for_string(G_CHECKSUM_SHA1, full, -1);
+    gchar* name = g_build_filename(g_get_user_cache_dir(), APPNAME, sum, NULL);
+    g_free(sum);
+    g_free(full);
+    return name;
+}
+
+static gboolean sample_file(gint fd, gsize size, gchar* out, gsize out_size)
+{
+    GChecksum* sum = g_checksum_new(G_CHECKSUM_SHA1);
+    guchar* buf = g_malloc(CACHE_SAMPLE);
+    gboolean ok = TRUE;
+    off_t offsets[2] = { 0, size > CACHE_SAMPLE ? (off_t)(size - CACHE_SAMPLE) : 0 };
+    for (guint i = 0; i < G_N_ELEMENTS(offsets) && ok; i++)
+    {
+        ssize_t n = pread(fd, buf, MIN(size, CACHE_SAMPLE), offsets[i]);
+        if (n < 0)
+            ok = FALSE;
+        else
+            g_checksum_update(sum, buf, n);
+    }
+    g_strlcpy(out, g_checksum_get_string(sum), out_size);
+    g_checksum_free(sum);
+    g_free(buf);
+    return ok;
+}
+
+static gboolean make_header(const gchar* path, cache_header_t* header)
+{
+    memset(header, 0, sizeof(*header));
+    gint fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return FALSE;
+    struct stat st;
+    gboolean ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+        && sample_file(fd, st.st_size, header->sample, sizeof(header->sample));
+    close(fd);
+    if (!ok)
+        return FALSE;
+
+    const gchar* charset = "raw";
+    if (!conf.raw)
+        g_get_charset(&charset);
+    memcpy(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header->version    = CACHE_VERSION;
+    header->whitelines = conf.whitelines;
+    header->delimiter  = (guchar) conf.delimiter;
+    header->dev        = st.st_dev;
+    header->ino        = st.st_ino;
+    header->size       = st.st_size;
+    header->mtime      = st.st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) + st.st_mtim.tv_nsec;
+    header->ctime      = st.st_ctim.tv_sec * G_GINT64_CONSTANT(1000000000) + st.st_ctim.tv_nsec;
+    g_strlcpy(header->charset, charset, sizeof(header->charset));
+    return TRUE;
+}
+
+static gboolean string_in_bounds(const gchar* data, gsize size, guint64 offset, guint64 len)
+{
+    return offset < size && len < size - offset && data[offset + len] == '\0';
+}
+
+static GString* mapped_string(GString* gs, gchar* data, guint64 offset, guint64 len)
+{
+    gs->str           = data + offset;
+    gs->len           = len;
+    gs->allocated_len = 0;
+    return gs;
+}
+
+gboolean cache_load(const gchar* path)
+{
+    cache_header_t header;
+    pending_valid = make_header(path, &header);
+    if (!pending_valid)
+        return FALSE;
+    pending = header;
+
+    gchar* name = cache_path(path);
+    GMappedFile* mapped = g_mapped_file_new(name, FALSE, NULL);
+    g_free(name);
+    if (!mapped)
+        return FALSE;
+
+    gchar* data = g_mapped_file_get_contents(mapped);
+    gsize  size = g_mapped_file_get_length(mapped);
+    cache_header_t* stored = (cache_header_t*) data;
+    if (size < sizeof(header) || memcmp(stored, &header, sizeof(header) - sizeof(header.lines)) != 0
+        || stored->lines > (size - sizeof(header)) / sizeof(cache_record_t))
+    {
+        g_mapped_file_unref(mapped);
+        return FALSE;
+    }
+
+    guint64 n = stored->lines;
+    cache_record_t* records = (cache_record_t*)(data + sizeof(header));
+    for (guint64 i = 0; i < n; i++)
+    {
+        cache_record_t* r = records + i;
+        if (!string_in_bounds(data, size, r->real_offset, r->real_len)
+            || !string_in_bounds(data, size, r->norm_offset, r->norm_len))
+        {
+            g_mapped_file_unref(mapped);
+            return FALSE;
+        }
+    }
+
+    /*the mapping stays alive for the lifetime of the lines pointing into it*/
+    line_t*  lines = g_new(line_t, n);
+    GString* gs    = g_new(GString, 2 * n);
+    for (guint64 i = 0; i < n; i++)
+    {
+        cache_record_t* r    = records + i;
+        line_t*         line = lines + i;
+        line->checked = conf.initial;
+        line->realstr = mapped_string(gs + 2 * i, data, r->real_offset, r->real_len);
+        if (r->norm_offset == r->real_offset)
+            line->string = line->realstr;
+        else
+            line->string = mapped_string(gs + 2 * i + 1, data, r->norm_offset, r->norm_len);
+        line->size    = r->norm_len;
+        line->width   = r->width;
+        line->length  = r->length;
+        line->white   = r->white;
+        line->checkpoints = NULL;
+        line->fullstr = line->string;
+        line->fields  = NULL;
+        line->runs    = NULL;
+        if (fields_active())
+        {
+            fields_apply(line);
+            line->size   = line->string->len;
+            line->length = g_utf8_strlen(line->string->str, line->string->len);
+            line->width  = g_utf8_strwidth(line->string->str);
+        }
+        if (preselect_line(line))
+            line->checked = TRUE;
+        if (line->width > max_string_width)
+            max_string_width = line->width;
+        g_ptr_array_add(strings, line);
+    }
+    return TRUE;
+}
+
+static gboolean write_block(FILE* f, gconstpointer data, gsize size)
+{
+    return fwrite(data, 1, size, f) == size;
+}
+
+/* Store lines from first to the end of strings as the snapshot of path. */
+void cache_store(const gchar* path, guint first)
+{
+    /*skip files that changed while they were being read*/
+    cache_header_t header;
+    if (!pending_valid || !make_header(path, &header) || memcmp(&header, &pending, sizeof(header)) != 0)
+        return;
+    pending_valid = FALSE;
+    header.lines = SL - first;
+
+    gchar* name = cache_path(path);
+    gchar* dir  = g_path_get_dirname(name);
+    gchar* tmp  = g_strdup_printf("%s.%d", name, getpid());
+    g_mkdir_with_parents(dir, 0700);
+    FILE* f = g_fopen(tmp, "wb");
+    gboolean ok = f != NULL;
+
+    guint64 offset = sizeof(header) + header.lines * sizeof(cache_record_t);
+    ok = ok && write_block(f, &header, sizeof(header));
+    for (guint i = first; i < SL && ok; i++)
+    {
+        line_t* line = get_line_t(i);
+        cache_record_t r = {0};
+        r.real_offset = offset;
+        r.real_len    = line->realstr->len;
+        offset       += r.real_len + 1;
+        r.norm_offset = r.real_offset;
+        r.norm_len    = r.real_len;
+        /*snapshots keep whole lines, whatever fields are shown*/
+        GString* norm = line->fullstr;
+        if (norm != line->realstr)
+        {
+            r.norm_offset = offset;
+            r.norm_len    = norm->len;
+            offset       += r.norm_len + 1;
+        }
+        r.width  = norm == line->string ? line->width  : g_utf8_strwidth(norm->str);
+        r.length = norm == line->string ? line->length : g_utf8_strlen(norm->str, norm->len);
+        r.white  = line->white;
+        ok = write_block(f, &r, sizeof(r));
+    }
+    for (guint i = first; i < SL && ok; i++)
+    {
+        line_t* line = get_line_t(i);
+        ok = write_block(f, line->realstr->str, line->realstr->len + 1);
+        if (ok && line->fullstr != line->realstr)
+            ok = write_block(f, line->fullstr->str, line->fullstr->len + 1);
+    }
+    if (f && fclose(f) != 0)
+        ok = FALSE;
+
+    if (ok && g_rename(tmp, name) != 0)
+        ok = FALSE;
+    if (!ok)
+    {
+        warn("can't write cache `%s': %s", name, g_strerror(errno));
+        g_unlink(tmp);
+    }
+    g_free(tmp);
+    g_free(dir);
+    g_free(name);
+}
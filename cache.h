@@ -0,0 +1,6 @@
+#pragma once
+
+#include "conf.h"
+
+gboolean cache_load(const gchar*);
+void     cache_store(const gchar*, guint);
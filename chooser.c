@@ -1,6 +1,15 @@
 #include "opts.h"
 #include "util.h"
 #include "curses.h"
+#include "server.h"
+#include "cache.h"
+#include "input.h"
+#include "follow.h"
+#include "output.h"
+#include "alloc.h"
+#include "exec.h"
+#include "source.h"
+#include "tree.h"
 
 #include <unistd.h>
 #include <locale.h>
@@ -13,20 +22,18 @@ guint max_string_width;
 conf_t conf;
 view_t view;
 
-#define CHAR_VT 0x000bu
-
 inline static void reopen_std_streams(void)
 {
     conf.original_stdout = stdout;
-    FILE* new_stdout = fopen("/dev/tty", "w");
+    FILE* new_stdout = fopen(conf.tty, "w");
     if (!new_stdout)
-        fatal("can't open /dev/tty");
+        fatal("can't open %s", conf.tty);
     stdout = new_stdout;
 
     conf.original_stdin = stdin;
-    FILE* new_stdin = fopen("/dev/tty", "r");
+    FILE* new_stdin = fopen(conf.tty, "r");
     if (!new_stdin)
-        fatal("can't open /dev/tty");
+        fatal("can't open %s", conf.tty);
     stdin = new_stdin;
 }
 
@@ -38,142 +45,92 @@ inline static void revert_std_streams(void)
     stdin  = conf.original_stdin;
 }
 
-static void adjust_channel_encoding(GIOChannel* channel, const gchar* name, gboolean binary)
-{
-    GIOStatus   status;
-    const char* charset;
-    if (!binary)
-        g_get_charset(&charset);
-    else
-        charset = NULL;
-    status = g_io_channel_set_encoding(channel, charset, NULL);
-    if (status != G_IO_STATUS_NORMAL)
-        fatal("can't set encoding `%s' for `%s'", charset == NULL? "binary" : charset, name);
-}
-
-static void read_channel(GIOChannel* reader, const gchar* name)
+inline static void read_data(void)
 {
-    if (!reader)
-        fatal("can't read `%s'", name);
-    adjust_channel_encoding(reader, name, FALSE);
-
-    GIOStatus   status;
-    g_io_channel_set_line_term(reader, NULL, -1);
-
-    GString* gstr   = g_string_new("");
-    while ( (status = g_io_channel_read_line_string(reader, gstr, NULL, NULL)) != G_IO_STATUS_EOF )
+    if (conf.source)
     {
-        if (status == G_IO_STATUS_ERROR)
-            fatal("error while reading `%s' occured", name);
-
-        gboolean is_white = TRUE;
-        gunichar c;
-        gchar*   p = gstr->str;
-        while (*p)
+        source_read();
+        return;
+    }
+    if ( !isatty(STDIN_FILENO) )
+    {
+        if (conf.follow)
+            follow_add(g_io_channel_unix_new(STDIN_FILENO), "stdin", TRUE);
+        else
+            read_input(STDIN_FILENO, "stdin");
+    }
+    register gint   i;
+    gchar**         p = conf.infiles;
+    for (i = 0; p[i] && p ; i++)
+    {
+        if (conf.follow)
         {
-            c = g_utf8_get_char(p);
-            p = g_utf8_next_char(p);
-            if (!g_unichar_isspace(c) && !(c == CHAR_VT) ) /*vertical tabulation is «space» symbol too*/
-            {
-                is_white = FALSE;
-                break;
-            }
+            follow_add(g_io_channel_new_file(p[i], "r", NULL), p[i], FALSE);
+            continue;
         }
-        if (is_white && !conf.whitelines)
+        if (conf.cache && cache_load(p[i]))
             continue;
-
-        line_t* line = g_new(line_t, 1);
-
-        gchar*  norm = g_utf8_normalize(gstr->str, gstr->len, G_NORMALIZE_ALL_COMPOSE);
-        GString* ns;
-        if (g_strcmp0(gstr->str, norm) == 0)
-            ns = gstr;
-        else
-            ns = g_string_new(norm);
-        g_free(norm);
-
-        line->checked = conf.initial;
-        line->realstr = gstr;
-        line->string  = ns;
-        line->size    = ns->len;
-        line->length  = g_utf8_strlen(ns->str, ns->len);
-        line->width   = g_utf8_strwidth(ns->str);
-        line->white   = is_white;
-        if (line->width > max_string_width)
-            max_string_width = line->width;
-
-        g_ptr_array_add(strings, line);
-        gstr = g_string_new("");
+        guint first = SL;
+        read_input(open(p[i], O_RDONLY), p[i]);
+        if (conf.cache)
+            cache_store(p[i], first);
     }
-
-    g_string_free(gstr, TRUE);
-    g_io_channel_shutdown(reader, FALSE, NULL);
-    g_io_channel_unref(reader);
+    if (conf.follow)
+        follow_wait();
 }
 
-inline static void read_data(void)
+/* Output the checked lines, or run --exec for them. */
+static gint finish_session(void)
 {
-    if ( !isatty(STDIN_FILENO) )
-        read_channel(g_io_channel_unix_new(STDIN_FILENO), "stdin");
-    register gint   i;
-    gchar**         p = conf.infiles;
-    for (i = 0; p[i] && p ; i++)
-        read_channel(g_io_channel_new_file(p[i], "r", NULL), p[i]);
+    if (conf.exec)
+        return exec_run();
+    write_data();
+    return EXIT_SUCCESS;
 }
 
-static void write_data(void)
+static gint session(void)
 {
-    GIOChannel* writer = g_io_channel_unix_new(STDOUT_FILENO);
-    if (!writer)
-        fatal("%s", "can't write to stdout");
-    adjust_channel_encoding(writer, "stdout", TRUE);
+    /*one element only, already checked. pass it quietly.*/
+    if (SL == 1 && conf.initial && !conf.follow)
+        return finish_session();
+
+    if (conf.stream)
+        stream_begin();
+    reopen_std_streams();
+    curses_init();
 
-    for (guint i = 0; i < SL; i++)
+    key_loop();
+
+    curses_deinit();
+    revert_std_streams();
+    if (conf.stream)
     {
-        line_t* lt = (line_t*) g_ptr_array_index(strings, i);
-        if (lt->checked)
-        {
-            glong  written = 0;
-            glong  size    = lt->realstr->len;
-            gchar* str     = lt->realstr->str;
-            while (written < size)
-            {
-                gsize written_once;
-                g_io_channel_write_chars(writer, str + written, size - written, &written_once, NULL);
-                written += written_once;
-            }
-            g_io_channel_flush(writer, NULL);
-        }
+        stream_flush();
+        return EXIT_SUCCESS;
     }
-    g_io_channel_shutdown(writer, TRUE, NULL);
-    g_io_channel_unref(writer);
+    return finish_session();
 }
 
 gint main(gint argc, gchar **argv)
 {
     setlocale(LC_ALL, "");
     parseopts(argc, argv);
+    if (conf.attach)
+        exit(attach(conf.attach));
+
     max_string_width = 0;
     strings = g_ptr_array_new();
+    alloc_phase("load");
     read_data();
 
     /*nothing to check, exit*/
     if (SL == 0)
         exit(EXIT_SUCCESS);
-    /*one element only, already checked. pass it quietly.*/
-    else if (SL == 1 && conf.initial)
-    {
-        write_data();
-        exit(EXIT_SUCCESS);
-    }
-
-    reopen_std_streams();
-    curses_init();
+    if (conf.tree)
+        tree_build();
 
-    key_loop();
+    if (conf.server)
+        serve(conf.server, session);
 
-    curses_deinit();
-    revert_std_streams();
-    write_data();
-    exit(EXIT_SUCCESS);
+    exit(session());
 }
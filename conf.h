@@ -20,6 +20,38 @@ typedef struct
     gboolean initial;
     gboolean fullattr;
     gboolean whitelines;
+    gboolean cache;
+    gboolean follow;
+    gboolean stream;
+    gboolean stream_unselect;
+    gboolean read0;
+    gboolean print0;
+    gboolean print_index;
+    gboolean raw;
+    gboolean query;
+    gboolean wrap;
+    gboolean tree;
+    gboolean ansi;
+    gchar*   tree_separator;
+    gchar*   delimiter_str;
+    gchar*   output_delimiter;
+    gchar    delimiter;
+    gint     threads;
+    gchar*   latency_log;
+    gchar*   field_delimiter;
+    gchar*   nth;
+    gchar*   with_nth;
+    gchar*   output_fields;
+    gchar*   preview;
+    gint     preview_width;
+    gchar*   exec;
+    gint     exec_parallel;
+    gint     exec_batch;
+    gchar*   preselect;
+    gchar*   preselect_regex;
+    gint     preselect_field;
+    gboolean preselect_normalized;
+    gchar*   source;
     gchar*   foreground;
     gchar*   background;
     short    fg;
@@ -29,6 +61,10 @@ typedef struct
 
     gchar**  infiles;
 
+    gchar*   server;
+    gchar*   attach;
+    gchar*   tty;
+
     FILE*    original_stdout;
     FILE*    original_stdin;
 } conf_t;
@@ -44,6 +80,12 @@ typedef struct
     glong    size;
 
     gboolean white;
+
+    GArray*  checkpoints;
+
+    GString* fullstr;
+    guint32* fields;
+    guint32* runs;
 } line_t;
 
 typedef struct
@@ -3,36 +3,134 @@
 
 #include "curses.h"
 #include "util.h"
+#include "follow.h"
+#include "loop.h"
+#include "search.h"
+#include "alloc.h"
+#include "latency.h"
+#include "highlight.h"
+#include "fields.h"
+#include "preselect.h"
+#include "source.h"
+#include "wrap.h"
+#include "tree.h"
+#include "selection.h"
+#include "ansi.h"
 
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <glib/gstdio.h>
 
-GArray*    grid;
 prompt_t   prompt;
 WINDOW*    ws;
 FILE*      null;
-#define    COLORPAIR 1
 
 inline static void repaint();
 static void regrid();
+static void toggle_checked_only();
+
+/*resizes only mark the grid stale; it is rebuilt once, before the frame*/
+static gboolean regrid_pending;
 
 #define bounds(x, min, max) x = MIN((max), MAX((min), (x)))
 
+/*
+ * Rows of the view. A row is a line, or with --tree a node of the path
+ * tree, which may be a directory no line stands for. In the checked-only
+ * view the rows are the checked lines, mapped by rank and select; once
+ * none is left, all lines are shown.
+ */
+#define VL shown_count()
+
+/*the checked-only view is on*/
+static gboolean checked_only;
+/*line under the cursor in that view, from before the selection last
+ *changed; once nothing is checked rows no longer map to lines*/
+static glong    checked_line;
+
+static inline gboolean only_checked(void)
+{
+    return checked_only && selection_count() > 0;
+}
+
+static inline glong shown_count(void)
+{
+    if (conf.tree)
+        return tree_shown();
+    return only_checked() ? selection_count() : (glong) SL;
+}
+
+/*line on row pos, or -1*/
+static inline glong line_at(glong pos)
+{
+    if (conf.tree)
+        return tree_line(pos);
+    return only_checked() ? selection_select(pos) : pos;
+}
+
+/*line searches on row pos start from*/
+static inline glong line_from(glong pos)
+{
+    return conf.tree ? tree_first(pos) : line_at(pos);
+}
+
+/*row of the line; with --tree the directories above it are expanded, in
+ *the checked-only view an unchecked line gives the row after it*/
+static inline glong pos_of(glong line)
+{
+    if (conf.tree)
+        return tree_pos(line);
+    return only_checked() ? selection_rank(line) : line;
+}
+
+static glong shown_width(glong pos)
+{
+    if (!conf.tree)
+        return get_width(line_at(pos));
+    gchar* text  = tree_text(pos);
+    glong  width = g_utf8_strwidth(text);
+    g_free(text);
+    return width;
+}
+
+static gchar* shown_substring(glong pos, glong start, glong finish)
+{
+    if (!conf.tree)
+        return get_utf8_substring_by_width(line_at(pos), start, finish);
+    gchar* text = tree_text(pos);
+    gchar* sub  = g_utf8_substring_by_width(text, start, finish);
+    g_free(text);
+    return sub;
+}
+
+static inline gboolean shown_checked(glong pos)
+{
+    return conf.tree ? tree_checked(pos) : is_checked(line_at(pos));
+}
+
+static inline void toggle_shown(glong pos)
+{
+    if (conf.tree)
+        tree_toggle_checked(pos);
+    else
+        toggle_checked(line_at(pos));
+}
+
 static gchar* get_prefix(glong index)
 {
     gchar* prefix;
     gchar space = ' ';
-    if (view.current == index && (view.top_x > 0 || is_white(index)) )
+    if (view.current == index && (view.top_x > 0 || (!conf.tree && is_white(line_at(index)))) )
         space = '>';
     prefix = g_strnfill(1, space);
 
     if (conf.numbers)
     {
         gchar* tmp = prefix;
+        glong line = line_at(index);
         glong max_n = num_digits(SL);
-        glong n = num_digits(index);
-        gchar* str_index = g_strdup_printf("%ld", index);
+        glong n = line < 0 ? 0 : num_digits(line);
+        gchar* str_index = line < 0 ? g_strdup("") : g_strdup_printf("%ld", line);
         gchar* num_prefix = g_strnfill(max_n - n, ' ');
         prefix = g_strconcat(num_prefix, str_index, tmp, NULL);
         g_free(tmp);
@@ -43,7 +141,7 @@ static gchar* get_prefix(glong index)
     if (conf.checkbox)
     {
         gchar* symbol = " ";
-        if (is_checked(index))
+        if (shown_checked(index))
         {
             symbol = "x";
             if (conf.radiobox) symbol = "o";
@@ -82,6 +180,7 @@ void curses_init()
         start_color();
         use_default_colors();
         init_pair(COLORPAIR, conf.fg, conf.bg);
+        init_pair(MATCHPAIR, COLOR_RED, -1);
     }
     else
         conf.color = FALSE;
@@ -96,77 +195,128 @@ void curses_init()
 
     prompt.buf   = g_string_new("");
     prompt.on    = false;
-    prompt.regex = NULL;
-
-    grid = g_array_sized_new(FALSE, TRUE, sizeof(grid_line_t*), SL);
-    for (glong i = 0; i < SL; i++)
-    {
-        grid_line_t* grid_line = g_malloc(sizeof(grid_line_t));
-        g_array_append_val(grid, grid_line);
-    }
+    prompt.query = NULL;
 
+    preview_init();
     regrid();
 }
 
 void curses_deinit()
 {
+    ansi_reset();
+    checked_only = FALSE;
+    selection_free();
+    preview_deinit();
     delwin(ws);
     endwin();
 }
 
+/*first screen row of the line at index*/
+static inline glong row_of(glong index)
+{
+    return conf.wrap ? wrap_row(index) : index / view.cols;
+}
+
+/* Scroll so that the current line is in sight; a wrapped line taller
+ * than the screen is shown from its top. */
 static inline void correct_top_y()
 {
-    bounds(view.current, 0, SL - 1);
+    bounds(view.current, 0, VL - 1);
     glong max = view.rows - EL;
     bounds(view.top_y, 0, max);
-    glong y   = view.current / view.cols;
-    bounds(view.top_y, MAX(0, (y - EL + 1)), y);
+    glong y   = row_of(view.current);
+    glong h   = conf.wrap ? MIN(wrap_height(view.current), EL) : 1;
+    bounds(view.top_y, MAX(0, (y + h - EL)), y);
 }
 
 static inline void correct_top_x()
 {
-    if (view.top_x < 0)
+    if (view.top_x < 0 || conf.wrap)
         view.top_x = 0;
     else
     {
-        glong max_top_x = MAX(0, (get_width(view.current) - COLS + view.prefix_width));
+        glong max_top_x = MAX(0, (shown_width(view.current) - EC + view.prefix_width));
         view.top_x = MIN(max_top_x, view.top_x);
     }
 }
 
+/* The cell of row i. Cells are all one size, so they are computed, and
+ * laying out the grid costs nothing per line: an attached session
+ * starts as fast on millions of lines as on ten. */
+static inline grid_line_t cell_of(glong i)
+{
+    grid_line_t cell = { (view.max_text_width + view.prefix_width) * (i % view.cols), i / view.cols };
+    return cell;
+}
+
+/*columns of text per cell; wrapped lines take the whole width*/
+static inline glong get_text_width(glong pw)
+{
+    return conf.wrap ? MAX(1, EC - pw) : MIN((EC - pw), max_string_width);
+}
+
 static void regrid()
 {
+    gint phase = alloc_phase("grid");
     glong pw = get_prefix_width();
     view.prefix_width   = pw;
-    glong mtw = MIN((COLS - pw), max_string_width);
+    glong mtw = get_text_width(pw);
     view.max_text_width = mtw;
     correct_top_x();
 
-    view.cols = conf.onecolumn ? 1 : (COLS / (mtw + pw));
-    view.rows = SL % view.cols == 0 ? SL / view.cols : (SL / view.cols) + 1;
+    if (conf.wrap)
+    {
+        /*rows come from the wrap index, not from cells*/
+        wrap_build(VL, mtw, shown_width);
+        view.cols = 1;
+        view.rows = wrap_rows();
+    }
+    else
+    {
+        view.cols = (conf.onecolumn || conf.tree) ? 1 : (EC / (mtw + pw));
+        view.rows = VL % view.cols == 0 ? VL / view.cols : (VL / view.cols) + 1;
+    }
     correct_top_y();
+    mvwin(ws, LINES - 1, 0);
+    preview_layout();
+    alloc_restore(phase);
+}
 
-    for (glong i = 0; i < SL; i++)
+/* Switch the look of a match span on or off, within the line at index. */
+static void match_attr(glong index, gboolean on)
+{
+    attr_t attr = A_BOLD | (conf.color ? COLOR_PAIR(MATCHPAIR) : 0);
+    if (on)
+        attron(attr);
+    else
     {
-        glong yn = i / view.cols;
-        glong xn = i % view.cols;
-        grid_line_t* grid_line = g_array_index(grid, grid_line_t*, i);
-        grid_line->y = yn;
-        grid_line->x = (mtw + pw) * xn;
+        attroff(attr);
+        if (is_checked(index) && conf.color)
+            attron(COLOR_PAIR(COLORPAIR));
     }
-    mvwin(ws, LINES - 1, 0);
 }
 
-static void draw_element(glong index)
+/* Attribute runs of the line as shown: none for tree rows, or when
+ * --with-nth shows other text than the runs were made for. */
+static inline const guint32* get_runs(glong line)
+{
+    if (conf.tree || line < 0)
+        return NULL;
+    line_t* l = get_line_t(line);
+    return l->string == l->fullstr ? l->runs : NULL;
+}
+
+/* Draw the columns start to finish of the line at index on screen row y.
+ * Only the first piece of a line gets its prefix, the rest blanks. */
+static void draw_piece(glong index, glong y, glong x, glong start, glong finish, gboolean first)
 {
-    grid_line_t* gl = g_array_index(grid, grid_line_t*, index);
-    gchar* prefix = get_prefix(index);
-    mvaddstr(gl->y - view.top_y, gl->x, prefix);
+    gchar* prefix = first ? get_prefix(index) : g_strnfill(view.prefix_width, ' ');
+    mvaddstr(y, x, prefix);
     g_free(prefix);
 
     if (index == view.current)
         standout();
-    if (is_checked(index))
+    if (shown_checked(index))
     {
         if (conf.color)
             attron(COLOR_PAIR(COLORPAIR));
@@ -174,20 +324,53 @@ static void draw_element(glong index)
             attron(A_UNDERLINE);
     }
 
-    glong start  = MIN(view.top_x, get_width(index));
-    glong finish = MIN(view.max_text_width, get_width(index) - start) + start;
     glong fill_width = view.max_text_width - (finish - start);
-    gchar* p = get_utf8_substring_by_width(index, start, finish);
+    gchar* p = shown_substring(index, start, finish);
     gchar* s = p;
     gunichar c;
-    while(*p)
+    /*matches of the last search are highlighted as they are passed*/
+    glong    line  = line_at(index);
+    GArray*  spans = conf.tree ? NULL : highlight_spans(prompt.query, line);
+    guint    k     = 0;
+    glong    col   = start;
+    gboolean lit   = FALSE;
+    /*and so are the --ansi colors of the line, under the matches*/
+    const guint32* runs = get_runs(line);
+    attr_t   base  = getattrs(stdscr);
+    attr_t   ansi  = 0;
+    guint    r     = 0;
+    gchar* end = p + (conf.raw ? finish - start : (glong) strlen(p));
+    while(p < end)
     {
-        c = get_unichar(p);
+        c = conf.raw ? raw_glyph(*p) : get_unichar(p);
+        while (runs && r < runs[0] && runs[1 + 2 * r] <= col)
+        {
+            attr_t next = ansi_attr(runs[2 + 2 * r++], base);
+            if (!lit)
+            {
+                attroff(ansi);
+                attron(next);
+            }
+            ansi = next;
+        }
+        while (spans && k < spans->len && g_array_index(spans, span_t, k).end <= col)
+            k++;
+        gboolean in = spans && k < spans->len && g_array_index(spans, span_t, k).start <= col;
+        if (in != lit)
+        {
+            match_attr(line, lit = in);
+            if (!lit)
+                attron(ansi);
+        }
         gchar* ns = g_ucs4_to_utf8(&c, 1, NULL, NULL, NULL);
         addstr(ns);
         g_free(ns);
-        p = g_utf8_next_char(p);
+        col += conf.raw ? 1 : gunichar_width(c);
+        p    = conf.raw ? p + 1 : g_utf8_next_char(p);
     }
+    if (lit)
+        match_attr(line, FALSE);
+    attroff(ansi);
     g_free(s);
     if (!conf.fullattr)
         standend();
@@ -197,6 +380,26 @@ static void draw_element(glong index)
     standend();
 }
 
+static void draw_element(glong index)
+{
+    glong width = shown_width(index);
+    if (!conf.wrap)
+    {
+        grid_line_t gl    = cell_of(index);
+        glong       start = MIN(view.top_x, width);
+        draw_piece(index, gl.y - view.top_y, gl.x, start, MIN(view.max_text_width, width - start) + start, TRUE);
+        return;
+    }
+    glong y = wrap_row(index) - view.top_y;
+    glong h = wrap_height(index);
+    for (glong k = 0; k < h && y < EL; k++, y++)
+    {
+        glong start = k * view.max_text_width;
+        if (y >= 0)
+            draw_piece(index, y, 0, start, MIN(start + view.max_text_width, width), k == 0);
+    }
+}
+
 static void redraw_search_line(gchar* search_method)
 {
     werase(ws);
@@ -252,7 +455,7 @@ static inline gchar* get_position_status()
     gchar* position;
     if (view.cols > 1)
     {
-        vcm  = num_digits(SL);
+        vcm  = num_digits(VL);
         position_format = g_strdup_printf("[№%%-%ldld:%%%ldld,%%-%ldld] %%3ld%%%% ", vcm, ynm, xnm);
         position = g_strdup_printf(position_format, view.current, yn, xn, percent);
     }
@@ -273,6 +476,37 @@ static void draw_status_line()
     mvwaddstr(ws, 0, width, position);
     width += strlen(position);
     g_free(position);
+    if (preselect_active())
+    {
+        gchar* preselected = g_strdup_printf("[%d preselected] ", preselect_matched());
+        mvwaddstr(ws, 0, width, preselected);
+        width += strlen(preselected);
+        g_free(preselected);
+    }
+    if (checked_only)
+    {
+        mvwaddstr(ws, 0, width, "[checked only] ");
+        width += strlen("[checked only] ");
+    }
+    if (source_reloading())
+    {
+        mvwaddstr(ws, 0, width, "[reloading] ");
+        width += strlen("[reloading] ");
+    }
+    else if (source_problem())
+    {
+        gchar* problem = g_strdup_printf("[reload: %s] ", source_problem());
+        mvwaddstr(ws, 0, width, problem);
+        width += strlen(problem);
+        g_free(problem);
+    }
+    gchar* progress = search_status();
+    if (progress)
+    {
+        mvwaddstr(ws, 0, width, progress);
+        width += strlen(progress);
+        g_free(progress);
+    }
     if (!prompt.on && prompt.buf->len > 0)
     {
         mvwaddstr(ws, 0, width, "[");
@@ -284,23 +518,60 @@ static void draw_status_line()
 static inline void draw()
 {
     correct_top_x();
-    for (glong i = view.top_y * view.cols; i < MIN(SL, view.cols *(EL + view.top_y)); i++)
+    if (conf.wrap)
+    {
+        for (glong i = wrap_line_at(view.top_y); i < VL && wrap_row(i) < view.top_y + EL; i++)
+            draw_element(i);
+        return;
+    }
+    for (glong i = view.top_y * view.cols; i < MIN(VL, view.cols *(EL + view.top_y)); i++)
         draw_element(i);
 }
 
 static inline void repaint()
 {
+    gint phase = alloc_phase("repaint");
     erase();
     werase(ws);
     draw();
     draw_status_line();
-    refresh();
-    wrefresh(ws);
+    wnoutrefresh(stdscr);
+    preview_show(line_at(view.current));
+    preview_draw();
+    wnoutrefresh(ws);
+    doupdate();
+    alloc_restore(phase);
+}
+
+/* Frame callback of the event loop. While the search prompt is open the
+ * terminal belongs to readline, so only the prompt is redrawn. A pending
+ * regrid is done first. */
+static void render()
+{
+    if (checked_only && selection_changed())
+    {
+        if (selection_count() == 0)
+            toggle_checked_only();
+        regrid_pending = TRUE;
+    }
+    if (regrid_pending)
+    {
+        regrid_pending = FALSE;
+        regrid();
+    }
+    latency_frame_begin();
+    if (prompt.on)
+        redraw_search_line(prompt.method);
+    else
+        repaint();
+    latency_frame_end();
+    if (only_checked())
+        checked_line = line_at(view.current);
 }
 
 static inline void center_view()
 {
-    view.top_y = view.current / view.cols - EL / 2;
+    view.top_y = row_of(view.current) - EL / 2;
     correct_top_y();
 }
 
@@ -312,6 +583,14 @@ static inline void move_element(glong i)
 
 static inline void move_page(glong i)
 {
+    if (conf.wrap)
+    {
+        glong row = MAX(0, wrap_row(view.current) + i * EL);
+        view.top_y += i * EL;
+        view.current = wrap_line_at(row);
+        correct_top_y();
+        return;
+    }
     view.top_y += i* EL;
     view.current += i * EL * view.cols;
     correct_top_y();
@@ -325,17 +604,39 @@ static inline void move_home()
 
 static inline void move_end()
 {
-    view.current = SL - 1;
+    view.current = VL - 1;
     view.top_y = MAX(view.rows - EL, 0);
 }
 
+/* With --tree, right expands the directory and left collapses it, or
+ * goes up to the directory the row is in. */
+static void move_tree(glong i)
+{
+    if (i > 0)
+        tree_expand(view.current, TRUE);
+    else if (!tree_expand(view.current, FALSE))
+    {
+        glong parent = tree_parent(view.current);
+        if (parent >= 0)
+            view.current = parent;
+    }
+    regrid_pending = TRUE;
+}
+
 static void move_horizontal(glong i)
 {
+    if (conf.tree)
+    {
+        move_tree(i);
+        return;
+    }
+    if (conf.wrap)
+        return;
     glong y = view.current / view.cols;
     glong x = view.current % view.cols + i;
     gint max_x = view.cols - 1;
     if (y == view.rows - 1)
-        max_x = SL - (view.rows - 1) * view.cols - 1;
+        max_x = VL - (view.rows - 1) * view.cols - 1;
     bounds(x, 0, max_x);
     view.current = view.cols * y + x;
     correct_top_y();
@@ -343,10 +644,15 @@ static void move_horizontal(glong i)
 
 static void move_vertical(glong i)
 {
+    if (conf.wrap)
+    {
+        move_element(i);
+        return;
+    }
     glong y = view.current / view.cols + i;
     glong x = view.current % view.cols;
     gint max_y = view.rows - 1;
-    gint max_x = SL - (view.rows - 1) * view.cols - 1;
+    gint max_x = VL - (view.rows - 1) * view.cols - 1;
     if (x > max_x)
         max_y = view.rows - 2;
 
@@ -359,20 +665,31 @@ static inline void x_move_left(glong offset)
 {
     if (offset > view.top_x)
         offset = view.top_x;
-    gchar* p = get_utf8_substring_by_width(view.current, view.top_x - offset, view.top_x);
-    view.top_x -= g_utf8_strwidth(p);
-    g_free(p);
+    /*raw columns are bytes, any offset lands on one*/
+    if (conf.raw)
+        view.top_x -= offset;
+    else
+    {
+        gchar* p = shown_substring(view.current, view.top_x - offset, view.top_x);
+        view.top_x -= g_utf8_strwidth(p);
+        g_free(p);
+    }
     correct_top_x();
 }
 
 static inline void x_move_right(glong offset)
 {
-    glong max_right_x = MAX(0, (glong)(get_width(view.current) - COLS + view.prefix_width));
+    glong max_right_x = MAX(0, (glong)(shown_width(view.current) - EC + view.prefix_width));
     if (offset > max_right_x - view.top_x)
         offset = max_right_x - view.top_x;
-    gchar* p = get_utf8_substring_by_width(view.current, view.top_x, view.top_x + offset);
-    view.top_x += g_utf8_strwidth(p);
-    g_free(p);
+    if (conf.raw)
+        view.top_x += MAX(0, offset);
+    else
+    {
+        gchar* p = shown_substring(view.current, view.top_x, view.top_x + offset);
+        view.top_x += g_utf8_strwidth(p);
+        g_free(p);
+    }
     correct_top_x();
 }
 
@@ -384,7 +701,7 @@ static inline void x_move_home()
 
 static inline void x_move_end()
 {
-    view.top_x = get_width(view.current) - COLS + view.prefix_width;
+    view.top_x = shown_width(view.current) - EC + view.prefix_width;
     correct_top_x();
 }
 
@@ -400,6 +717,33 @@ static inline void toggle_option(gboolean* b, gboolean do_regrid)
         regrid();
 }
 
+/* Show only the checked lines, or all of them again, staying on the
+ * current line. With nothing checked the view stays as it is. */
+static void toggle_checked_only()
+{
+    if (conf.tree)
+        return;
+    glong line = only_checked() || !checked_only ? line_at(view.current) : checked_line;
+    if (checked_only)
+    {
+        checked_only = FALSE;
+        selection_free();
+    }
+    else
+    {
+        selection_build();
+        if (selection_count() == 0)
+        {
+            selection_free();
+            return;
+        }
+        checked_only = TRUE;
+    }
+    view.current = pos_of(line);
+    regrid();
+    center_view();
+}
+
 static inline void toggle_color()
 {
     if (has_colors())
@@ -417,87 +761,154 @@ static void cb_search()
     prompt.on = false;
     curs_set(false);
     resetty();
+
+    query_unref(prompt.query);
+    prompt.query = query_new(prompt.buf->str, prompt.flags | (conf.raw ? G_REGEX_RAW : 0), conf.query);
+    if (prompt.then)
+        prompt.then();
+    loop_request_frame();
 }
 
-static void find_next_line_mathching()
+/* Go to a matching line and scroll horizontally to its first match,
+ * unless that is in sight already. */
+static void jump_to_match(glong index)
 {
-    if (prompt.regex == NULL)
-        return;
-    guint c = view.current;
-    for (guint i = c + 1; i <= SL + c; i++)
+    view.current = pos_of(index);
+    if (conf.tree)
+        regrid_pending = TRUE;
+    center_view();
+    GArray* spans = conf.tree ? NULL : highlight_spans(prompt.query, index);
+    if (spans && spans->len > 0)
     {
-        if (g_regex_match(prompt.regex, get_str(i % SL), G_REGEX_MATCH_NOTEMPTY, NULL))
-        {
-            view.current = i % SL;
-            center_view();
-            break;
-        }
+        span_t first = g_array_index(spans, span_t, 0);
+        if (first.start < view.top_x || first.end > view.top_x + view.max_text_width)
+            view.top_x = MAX(0, first.start - view.max_text_width / 4);
     }
 }
 
-static void find_prev_line_mathching()
+static void find_line_mathching(gint direction)
 {
-    if (prompt.regex == NULL)
+    if (prompt.query == NULL)
         return;
-    guint c = view.current;
-    for (guint i = SL + c - 1; i >= c - 1; i--)
-    {
-        if (g_regex_match(prompt.regex, get_str(i % SL), G_REGEX_MATCH_NOTEMPTY, NULL))
-        {
-            view.current = i % SL;
-            center_view();
-            break;
-        }
-    }
+    glong i = search_found_after(prompt.query, line_from(view.current), direction);
+    if (i >= 0)
+        jump_to_match(i);
+    else if (i == -1 && !search_running())
+        search_run(prompt.query, direction, line_from(view.current), jump_to_match);
+}
+
+static void find_next_line_mathching()
+{
+    find_line_mathching(1);
+}
+
+static void find_prev_line_mathching()
+{
+    find_line_mathching(-1);
+}
+
+static void check_match(glong index)
+{
+    set_checked(index, TRUE);
+}
+
+static void uncheck_match(glong index)
+{
+    set_checked(index, FALSE);
+}
+
+static void toggle_match(glong index)
+{
+    toggle_checked(index);
 }
 
 static void check_founded(gint do_toggle)
 {
     if (conf.radiobox)
         return;
-    if (prompt.regex != NULL)
+    if (prompt.query != NULL)
     {
-        for (guint i = 0; i < SL; i++)
-        {
-            if (g_regex_match(prompt.regex, get_str(i), G_REGEX_MATCH_NOTEMPTY, NULL))
-            {
-                if (do_toggle == 0)
-                    toggle_checked(i);
-                else if (do_toggle > 0)
-                    set_checked(i, TRUE);
-                else
-                    set_checked(i, FALSE);
-            }
-        }
+        if (do_toggle == 0)
+            search_run(prompt.query, 0, 0, toggle_match);
+        else if (do_toggle > 0)
+            search_run(prompt.query, 0, 0, check_match);
+        else
+            search_run(prompt.query, 0, 0, uncheck_match);
     }
 }
 
-static void perform_search(GRegexCompileFlags compile_options)
+/* Open the search prompt. Input goes to readline until the search is
+ * entered; then the query is compiled and then() is run. */
+static void perform_search(GRegexCompileFlags compile_options, void (*then)())
 {
     rl_outstream = null;
     Keymap map_vi    = rl_get_keymap_by_name("vi");
     Keymap map_emacs = rl_get_keymap_by_name("emacs");
     rl_unbind_key_in_map(CTRL('l'), map_vi);
     rl_unbind_key_in_map(CTRL('l'), map_emacs);
+    search_cancel();
     savetty();
     //It's a kind of magic.
     reset_shell_mode();
     curs_set(true);
-    prompt.on = true;
+    prompt.on     = true;
+    prompt.flags  = compile_options;
+    prompt.then   = then;
+    prompt.method = (compile_options & G_REGEX_CASELESS) ? "Ignore Case " : "";
     rl_callback_handler_install("", (void (*)(char *)) cb_search);
     def_shell_mode();
-    gchar* search_method = (compile_options & G_REGEX_CASELESS) ? "Ignore Case " : "";
-    redraw_search_line(search_method);
-    while(true)
+    loop_request_frame();
+}
+
+/*line the cursor was moved to by following; it stays pinned while there*/
+static glong followed = -1;
+
+/* Lay out lines appended since first, regridding only if they changed
+ * the cell size. A cursor pinned to the end follows the new lines, or
+ * only the new matches while a search is active. */
+static void append_elements(glong first)
+{
+    gboolean pinned = !checked_only && (view.current == first - 1 || view.current == followed);
+    if (checked_only)
+        selection_sync();
+    if (conf.stream)
     {
-        rl_callback_read_char();
-        if (!prompt.on)
-            break;
-        redraw_search_line(search_method);
+        for (glong i = first; i < SL; i++)
+            if (is_checked(i))
+                stream_line(i, TRUE);
+        stream_flush();
+    }
+
+    glong pw  = get_prefix_width();
+    glong mtw = get_text_width(pw);
+    if (pw != view.prefix_width || mtw != view.max_text_width || checked_only)
+        regrid();
+    else if (conf.wrap)
+    {
+        wrap_append(VL);
+        view.rows = wrap_rows();
+    }
+    else
+        view.rows = SL % view.cols == 0 ? SL / view.cols : (SL / view.cols) + 1;
+
+    loop_request_frame();
+    if (!pinned)
+        return;
+    glong target = SL - 1;
+    if (prompt.query != NULL)
+    {
+        target = view.current;
+        for (glong i = SL - 1; i >= first; i--)
+        {
+            if (fields_match(prompt.query, get_line_t(i)))
+            {
+                target = i;
+                break;
+            }
+        }
     }
-    if (prompt.regex != NULL)
-        g_regex_unref(prompt.regex);
-    prompt.regex = g_regex_new(prompt.buf->str, compile_options, G_REGEX_MATCH_NOTEMPTY, NULL);
+    view.current = followed = target;
+    correct_top_y();
 }
 
 /* static inline const gchar* get_key(wint_t* key) */
@@ -514,173 +925,285 @@ static void perform_search(GRegexCompileFlags compile_options)
 /*     return name; */
 /* } */
 
-void key_loop()
+/* Keys that move by one step. A run of the same key is applied as a
+ * single move of n steps. Returns FALSE for other keys. */
+static gboolean move_repeated(wint_t key, glong n)
 {
-    repaint();
-    wint_t key;
-    /* const gchar* name; */
-
-    while(TRUE)
+    switch(key)
     {
-        get_wch(&key);
-        /* name = get_key(&key); */
-        gboolean do_repaint = TRUE;
-
-        switch(key)
-        {
-        case 'm':
-            check_founded(1);
-            break;
-        case 'M':
-            check_founded(-1);
-            break;
-        case 'T':
-            check_founded(0);
-            break;
-        case 's':
-            perform_search(G_REGEX_CASELESS);
-            break;
-        case 'S':
-            perform_search(0);
-            break;
-        case '/':
-            perform_search(G_REGEX_CASELESS);
-            find_next_line_mathching();
-            break;
-        case '?':
-            perform_search(G_REGEX_CASELESS);
-            find_prev_line_mathching();
-            break;
-        case 'n':
-            find_next_line_mathching();
-            break;
-        case 'N':
-            find_prev_line_mathching();
-            break;
-        case 'c':
-            clear_search();
-            break;
+    case CTRL('i'):
+        move_element(n);
+        break;
+    case KEY_BTAB:
+        move_element(-n);
+        break;
+    case KEY_DOWN:
+    case 'j':
+        move_vertical(n);
+        break;
+    case KEY_UP:
+    case 'k':
+        move_vertical(-n);
+        break;
+    case KEY_LEFT:
+    case 'h':
+        move_horizontal(-n);
+        break;
+    case KEY_RIGHT:
+    case 'l':
+        move_horizontal(n);
+        break;
+    case KEY_NPAGE:
+        move_page(n);
+        break;
+    case KEY_PPAGE:
+        move_page(-n);
+        break;
+    case ',':
+        x_move_left(n);
+        break;
+    case '.':
+        x_move_right(n);
+        break;
+    default:
+        return FALSE;
+    }
+    loop_request_frame();
+    return TRUE;
+}
 
-        case 'z':
-            center_view();
-            break;
-        case CTRL('i'):
-            move_element(1);
-            break;
-        case KEY_BTAB:
-            move_element(-1);
-            break;
-        case KEY_DOWN:
-        case 'j':
-            move_vertical(1);
-            break;
-        case KEY_UP:
-        case 'k':
-            move_vertical(-1);
-            break;
-        case KEY_LEFT:
-        case 'h':
-            move_horizontal(-1);
-            break;
-        case KEY_RIGHT:
-        case 'l':
-            move_horizontal(1);
-            break;
-        case KEY_NPAGE:
-            move_page(1);
-            break;
-        case KEY_PPAGE:
-            move_page(-1);
-            break;
-        case 'G':
-            move_end();
-            break;
-        case 'g':
-            move_home();
-            break;
-        case ',':
-            x_move_left(1);
-            break;
-        case 'H':
-        case '<':
-            x_move_left(COLS/2);
-            break;
-        case '.':
-            x_move_right(1);
-            break;
-        case 'L':
-        case '>':
-            x_move_right(COLS/2);
-            break;
-        case KEY_HOME:
-        case '^':
-            x_move_home();
-            break;
-        case KEY_END:
-        case '$':
-            x_move_end();
-            break;
+static inline gboolean is_movement(wint_t key)
+{
+    return key == CTRL('i') || key == KEY_BTAB || key == KEY_DOWN || key == 'j' || key == KEY_UP || key == 'k'
+        || key == KEY_LEFT || key == 'h' || key == KEY_RIGHT || key == 'l' || key == KEY_NPAGE || key == KEY_PPAGE
+        || key == ',' || key == '.';
+}
 
-        case ' ':
-            toggle_checked(view.current);
-            break;
-        case '!':
-            uncheck_all();
-            toggle_checked(view.current);
-            break;
-        case 't':
-            toggle_all();
-            break;
-        case 'a':
-            check_all();
-            break;
-        case 'A':
-            uncheck_all();
-            break;
+/* New lines from --source are in place; lay them out. */
+static void on_reloaded(glong current, gboolean searching)
+{
+    if (conf.tree)
+        tree_build();
+    if (checked_only)
+        selection_build();
+    view.current   = pos_of(current);
+    followed       = -1;
+    regrid_pending = TRUE;
+    if (searching)
+        search_restart();
+    loop_request_frame();
+}
 
-        case 'x':
-            toggle_option(&conf.checkbox, true);
-            break;
-        case '#':
-            toggle_option(&conf.numbers, true);
-            break;
-        case 'o':
-        case '1':
-            toggle_option(&conf.onecolumn, true);
-            break;
-        case 'u':
-            toggle_option(&conf.underline, false);
-            break;
-        case 'f':
-            toggle_option(&conf.fullattr, false);
-            break;
-        case 'r':
-            toggle_radiobox();
-            break;
-        case 'C':
-            toggle_color();
-            break;
+/* Handle a key pressed outside the search prompt. Returns FALSE when the
+ * session is over. */
+static gboolean handle_key(wint_t key)
+{
+    gboolean do_repaint = TRUE;
+    if (only_checked())
+        checked_line = line_at(view.current);
 
-        case KEY_RESIZE:
-        case KEY_REFRESH:
-        case CTRL('l'):
-            regrid();
-            break;
+    switch(key)
+    {
+    case 'm':
+        check_founded(1);
+        break;
+    case 'M':
+        check_founded(-1);
+        break;
+    case 'T':
+        check_founded(0);
+        break;
+    case 's':
+        perform_search(G_REGEX_CASELESS, NULL);
+        break;
+    case 'S':
+        perform_search(0, NULL);
+        break;
+    case '/':
+        perform_search(G_REGEX_CASELESS, find_next_line_mathching);
+        break;
+    case '?':
+        perform_search(G_REGEX_CASELESS, find_prev_line_mathching);
+        break;
+    case 'n':
+        find_next_line_mathching();
+        break;
+    case 'N':
+        find_prev_line_mathching();
+        break;
+    case 'c':
+        clear_search();
+        break;
+
+    case 'z':
+        center_view();
+        break;
+    case 'G':
+        move_end();
+        break;
+    case 'g':
+        move_home();
+        break;
+    case 'H':
+    case '<':
+        x_move_left(EC/2);
+        break;
+    case 'L':
+    case '>':
+        x_move_right(EC/2);
+        break;
+    case KEY_HOME:
+    case '^':
+        x_move_home();
+        break;
+    case KEY_END:
+    case '$':
+        x_move_end();
+        break;
+
+    case ' ':
+        toggle_shown(view.current);
+        break;
+    case '!':
+        uncheck_all();
+        if (checked_only)
+            toggle_checked(checked_line);
+        else
+            toggle_shown(view.current);
+        break;
+    case 't':
+        toggle_all();
+        break;
+    case 'a':
+        check_all(line_at(view.current));
+        break;
+    case 'A':
+        uncheck_all();
+        break;
+
+    case 'x':
+        toggle_option(&conf.checkbox, true);
+        break;
+    case '#':
+        toggle_option(&conf.numbers, true);
+        break;
+    case 'o':
+    case '1':
+        toggle_option(&conf.onecolumn, true);
+        break;
+    case 'w':
+        toggle_option(&conf.wrap, true);
+        break;
+    case 'v':
+        toggle_checked_only();
+        break;
+    case 'u':
+        toggle_option(&conf.underline, false);
+        break;
+    case 'f':
+        toggle_option(&conf.fullattr, false);
+        break;
+    case 'r':
+        toggle_radiobox(line_at(view.current));
+        break;
+    case 'C':
+        toggle_color();
+        break;
+
+    case KEY_RESIZE:
+    case KEY_REFRESH:
+    case CTRL('l'):
+        regrid_pending = TRUE;
+        break;
+
+    case KEY_ENTER:
+    case '\n':
+    case '\r':
+        return FALSE;
+    case 'q':
+        uncheck_all();
+        return FALSE;
+
+    case 27 :
+        search_cancel();
+        break;
+    case 'R':
+        source_reload(line_from(view.current), on_reloaded);
+        loop_request_frame();
+        break;
+    default :
+        do_repaint = FALSE;
+    }
 
-        case KEY_ENTER:
-        case '\n':
-        case '\r':
-            return;
-        case 'q':
-            uncheck_all();
-            return;
+    if (conf.stream)
+        stream_flush();
+    if (do_repaint)
+        loop_request_frame();
+    return TRUE;
+}
 
-        case 27 :
-        default :
-            do_repaint = FALSE;
+/* The terminal is readable (or a signal arrived): feed readline while the
+ * prompt is open, otherwise handle every key that is already there. */
+static void on_tty(gint fd, G_GNUC_UNUSED gpointer data)
+{
+    gint phase = alloc_phase("keys");
+    if (prompt.on)
+    {
+        if (fd >= 0)
+        {
+            latency_key(-1);
+            rl_callback_read_char();
+        }
+        loop_request_frame();
+        alloc_restore(phase);
+        return;
+    }
+    /*everything already typed is handled before the next frame*/
+    wint_t key;
+    wint_t run_key = 0;
+    glong  run     = 0;
+    nodelay(stdscr, TRUE);
+    while (!prompt.on && get_wch(&key) != ERR)
+    {
+        latency_key(key);
+        if (run > 0 && key == run_key)
+        {
+            run++;
+            continue;
+        }
+        if (run > 0)
+            move_repeated(run_key, run);
+        run = 0;
+        if (is_movement(key))
+        {
+            run_key = key;
+            run     = 1;
+        }
+        else if (!handle_key(key))
+        {
+            loop_quit();
+            break;
         }
-
-        if (do_repaint)
-            repaint();
     }
+    if (run > 0)
+        move_repeated(run_key, run);
+    nodelay(stdscr, FALSE);
+    if (!loop_frame_requested())
+        latency_keys_done();
+    alloc_restore(phase);
+}
+
+void key_loop()
+{
+    if (conf.latency_log)
+        latency_open(conf.latency_log);
+    loop_add_fd(fileno(stdin), on_tty, NULL);
+    loop_on_signal(on_tty, NULL);
+    if (follow_active())
+        follow_start(append_elements);
+    loop_request_frame();
+    loop_run(render);
+    search_cancel();
+    loop_remove_fd(fileno(stdin));
+    latency_close();
 }
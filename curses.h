@@ -1,12 +1,18 @@
 #pragma once
 
 #include "conf.h"
+#include "preview.h"
+#include "query.h"
 
 typedef struct
 {
     gboolean on;
     GString* buf;
-    GRegex*  regex;
+    query_t* query;
+
+    GRegexCompileFlags flags;
+    gchar*             method;
+    void             (*then)();
 }
 prompt_t;
 
@@ -17,8 +23,15 @@ typedef struct
 }
 grid_line_t;
 
+#define COLORPAIR 1
+#define MATCHPAIR 2
+/*pairs from ANSIPAIR on are made for --ansi colors as they are met*/
+#define ANSIPAIR  3
+
 //effective LINES, last line is for status bar
 #define EL (LINES - 1)
+//effective COLS, the preview pane takes the rest
+#define EC (COLS - preview_cols())
 
 void curses_init();
 void curses_deinit();
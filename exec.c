@@ -0,0 +1,206 @@
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "exec.h"
+#include "util.h"
+#include "fields.h"
+
+/*
+ * --exec CMD runs CMD by sh for the checked lines once the session ends,
+ * instead of printing them. Every {} in CMD is replaced by the quoted
+ * lines of a job, or they are appended to CMD if it has none. A job takes
+ * --exec-batch lines, and --exec-parallel jobs run at once. With
+ * --output-fields a job is given those fields of each line.
+ *
+ * Lines are taken in the order write_data() prints them. The output of a
+ * job, stderr included, is collected and written when all jobs before it
+ * have been written, so it comes out in order. A failed job is reported
+ * with its lines. Jobs are not started more than a window ahead of the
+ * oldest unwritten one, which bounds the output held back.
+ */
+
+typedef struct
+{
+    GPid     pid;
+    gint     fd;
+    GString* out;
+    GString* lines;
+    gint     status;
+    gboolean done;
+} job_t;
+
+static gchar** template;
+
+static gchar* job_script(GString* quoted)
+{
+    if (g_strv_length(template) > 1)
+        return g_strjoinv(quoted->str, template);
+    return g_strconcat(conf.exec, " ", quoted->str, NULL);
+}
+
+static void start(job_t* job, GString* quoted)
+{
+    gchar*  cmd    = job_script(quoted);
+    gchar*  script = g_strconcat("exec 2>&1; ", cmd, NULL);
+    gchar*  argv[] = { "/bin/sh", "-c", script, NULL };
+    gint    in;
+    GError* err    = NULL;
+
+    job->out  = g_string_new("");
+    job->done = FALSE;
+    if (g_spawn_async_with_pipes(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL,
+                                 &job->pid, &in, &job->fd, NULL, &err))
+        close(in);
+    else
+    {
+        job->fd     = -1;
+        job->status = -1;
+        job->done   = TRUE;
+        g_string_append_printf(job->out, "%s\n", err->message);
+        g_error_free(err);
+    }
+    g_free(script);
+    g_free(cmd);
+}
+
+static void finish(job_t* job)
+{
+    close(job->fd);
+    job->fd = -1;
+    while (waitpid(job->pid, &job->status, 0) < 0 && errno == EINTR);
+    g_spawn_close_pid(job->pid);
+    job->done = TRUE;
+}
+
+/* Read what is ready from the running jobs, waiting until something is. */
+static void collect(job_t* jobs, guint n)
+{
+    GArray* fds = g_array_new(FALSE, FALSE, sizeof(struct pollfd));
+    for (guint i = 0; i < n; i++)
+        if (!jobs[i].done)
+        {
+            struct pollfd p = { jobs[i].fd, POLLIN, 0 };
+            g_array_append_val(fds, p);
+        }
+    if (fds->len > 0 && poll((struct pollfd*) fds->data, fds->len, -1) < 0 && errno != EINTR)
+        fatal("poll failed: %s", g_strerror(errno));
+
+    for (guint k = 0; k < fds->len; k++)
+    {
+        struct pollfd* p = &g_array_index(fds, struct pollfd, k);
+        if (!p->revents)
+            continue;
+        for (guint i = 0; i < n; i++)
+            if (!jobs[i].done && jobs[i].fd == p->fd)
+            {
+                gchar   chunk[65536];
+                ssize_t n = read(p->fd, chunk, sizeof(chunk));
+                if (n > 0)
+                    g_string_append_len(jobs[i].out, chunk, n);
+                else if (n == 0 || errno != EINTR)
+                    finish(&jobs[i]);
+                break;
+            }
+    }
+    g_array_free(fds, TRUE);
+}
+
+/* The text a line stands for in a job: what write_data() would print for
+ * it, without the terminator. */
+static gchar* job_text(line_t* line)
+{
+    if (!fields_output())
+        return g_strndup(line->realstr->str, record_len(line->realstr->str, line->realstr->len));
+    GString* buf = g_string_new("");
+    fields_append_output(buf, line);
+    return g_string_free(buf, FALSE);
+}
+
+/* Write out a finished job; FALSE if it failed. */
+static gboolean emit(job_t* job)
+{
+    write_all(STDOUT_FILENO, job->out->str, job->out->len);
+    gboolean ok = job->status == 0;
+    if (!ok)
+    {
+        if (job->status > 0 && WIFEXITED(job->status))
+            warn("exited with %d: %s", WEXITSTATUS(job->status), job->lines->str);
+        else if (job->status > 0 && WIFSIGNALED(job->status))
+            warn("killed by signal %d: %s", WTERMSIG(job->status), job->lines->str);
+        else
+            warn("could not run: %s", job->lines->str);
+    }
+    g_string_free(job->out, TRUE);
+    g_string_free(job->lines, TRUE);
+    return ok;
+}
+
+/* Run --exec for the checked lines. Returns the exit status: 0, or 123
+ * if any job failed, as xargs does. */
+gint exec_run(void)
+{
+    guint parallel = MAX(1, conf.exec_parallel);
+    guint batch    = MAX(1, conf.exec_batch);
+    guint window   = 4 * parallel;
+    template = g_strsplit(conf.exec, "{}", -1);
+
+    /*jobs are numbered in order; a slot is reused every window jobs*/
+    job_t*   jobs    = g_new0(job_t, window);
+    for (guint i = 0; i < window; i++)
+        jobs[i].done = TRUE;
+    guint    started = 0;
+    guint    emitted = 0;
+    guint    running = 0;
+    guint    next    = 0;
+    gboolean ok      = TRUE;
+    while (TRUE)
+    {
+        while (running < parallel && started - emitted < window)
+        {
+            GString* quoted = g_string_new("");
+            GString* lines  = g_string_new("");
+            guint    taken  = 0;
+            for (; next < SL && taken < batch; next++)
+            {
+                if (!is_checked(next))
+                    continue;
+                gchar*  text = job_text(get_line_t(next));
+                gchar*  q    = g_shell_quote(text);
+                g_string_append_printf(quoted, "%s%s", taken ? " " : "", q);
+                g_string_append_printf(lines,  "%s%s", taken ? ", " : "", text);
+                g_free(q);
+                g_free(text);
+                taken++;
+            }
+            if (taken == 0)
+            {
+                g_string_free(quoted, TRUE);
+                g_string_free(lines, TRUE);
+                break;
+            }
+            job_t* job = &jobs[started % window];
+            job->lines = lines;
+            start(job, quoted);
+            g_string_free(quoted, TRUE);
+            started++;
+            if (!job->done)
+                running++;
+        }
+
+        while (emitted < started && jobs[emitted % window].done)
+            ok = emit(&jobs[emitted++ % window]) && ok;
+        if (emitted == started && next >= SL)
+            break;
+
+        collect(jobs, window);
+        running = 0;
+        for (guint i = emitted; i < started; i++)
+            running += !jobs[i % window].done;
+    }
+    g_free(jobs);
+    g_strfreev(template);
+    return ok ? EXIT_SUCCESS : 123;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "conf.h"
+
+gint exec_run(void);
@@ -0,0 +1,347 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "fields.h"
+#include "util.h"
+
+/*
+ * Field mode. With --nth, --with-nth or --output-fields every line is split
+ * into fields once, when it is read. The offsets go to line->fields: the
+ * number of fields, then the start and the end of each field in
+ * line->fullstr. Display then shows the --with-nth fields joined, search
+ * matches each --nth field in place, and output writes the --output-fields
+ * fields.
+ *
+ * Fields are separated by --field-delimiter, or by runs of blanks as in
+ * awk, in which case blanks around the line are not part of any field.
+ * A field list is a comma separated list of N, N..M, N.. and ..M, where a
+ * negative N counts from the last field.
+ */
+
+typedef struct
+{
+    gint from;
+    gint to;
+} range_t;
+
+static GArray* nth;
+static GArray* with_nth;
+static GArray* output_fields;
+static gsize   delimiter_len;
+
+static gboolean parse_index(const gchar* s, gint* n)
+{
+    gchar* end;
+    if (*s == '\0')
+    {
+        *n = 0;
+        return TRUE;
+    }
+    *n = strtol(s, &end, 10);
+    return *end == '\0' && *n != 0;
+}
+
+static GArray* parse_ranges(const gchar* option, const gchar* spec)
+{
+    if (!spec)
+        return NULL;
+    GArray* ranges = g_array_new(FALSE, FALSE, sizeof(range_t));
+    gchar** items  = g_strsplit(spec, ",", -1);
+    for (gchar** item = items; *item; item++)
+    {
+        range_t r;
+        gchar*  dots = strstr(*item, "..");
+        gboolean ok;
+        if (dots)
+        {
+            *dots = '\0';
+            ok = parse_index(*item, &r.from) && parse_index(dots + 2, &r.to);
+        }
+        else
+        {
+            ok = **item != '\0' && parse_index(*item, &r.from);
+            r.to = r.from;
+        }
+        if (!ok)
+            fatal("bad field list `%s' for --%s", spec, option);
+        g_array_append_val(ranges, r);
+    }
+    g_strfreev(items);
+    return ranges;
+}
+
+void fields_init(void)
+{
+    nth           = parse_ranges("nth",           conf.nth);
+    with_nth      = parse_ranges("with-nth",      conf.with_nth);
+    output_fields = parse_ranges("output-fields", conf.output_fields);
+    if (conf.field_delimiter)
+    {
+        gchar* d = g_strcompress(conf.field_delimiter);
+        g_free(conf.field_delimiter);
+        conf.field_delimiter = d;
+        delimiter_len = strlen(d);
+        if (delimiter_len == 0)
+            fatal("field delimiter must not be empty");
+    }
+}
+
+gboolean fields_active(void)
+{
+    return nth || with_nth || output_fields;
+}
+
+gboolean fields_output(void)
+{
+    return output_fields != NULL;
+}
+
+static inline gboolean is_blank(gchar c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static guint32* split(const gchar* s, gsize len)
+{
+    GArray* a = g_array_new(FALSE, FALSE, sizeof(guint32));
+    guint32 v = 0;
+    g_array_append_val(a, v);
+    len = record_len(s, len);
+    gsize p = 0;
+    if (!conf.field_delimiter)
+        while (TRUE)
+        {
+            while (p < len && is_blank(s[p]))
+                p++;
+            if (p == len)
+                break;
+            v = p;
+            g_array_append_val(a, v);
+            while (p < len && !is_blank(s[p]))
+                p++;
+            v = p;
+            g_array_append_val(a, v);
+        }
+    else
+        while (TRUE)
+        {
+            const gchar* d = g_strstr_len(s + p, len - p, conf.field_delimiter);
+            v = p;
+            g_array_append_val(a, v);
+            v = d ? (gsize) (d - s) : len;
+            g_array_append_val(a, v);
+            if (!d)
+                break;
+            p = v + delimiter_len;
+        }
+    g_array_index(a, guint32, 0) = (a->len - 1) / 2;
+    return (guint32*) g_array_free(a, FALSE);
+}
+
+/* Bounds of field n of a record, counting from 1, or from the end if n is
+ * negative. FALSE if there is no such field. */
+gboolean fields_nth(const gchar* s, gsize len, gint n, gsize* start, gsize* end)
+{
+    guint32* fields = split(s, len);
+    gint     count  = fields[0];
+    if (n < 0)
+        n = count + n + 1;
+    gboolean ok = n >= 1 && n <= count;
+    if (ok)
+    {
+        *start = fields[2 * n - 1];
+        *end   = fields[2 * n];
+    }
+    g_free(fields);
+    return ok;
+}
+
+/* Call cb on each field selected by ranges, in their order, until it
+ * returns TRUE. */
+typedef gboolean (*field_cb)(const gchar*, gsize, gpointer);
+
+/* Fields from..to of range r, of n fields. */
+static inline void bounds_of(range_t r, gint n, gint* from, gint* to)
+{
+    *from = MAX(r.from < 0 ? n + r.from + 1 : r.from ? r.from : 1, 1);
+    *to   = MIN(r.to   < 0 ? n + r.to   + 1 : r.to   ? r.to   : n, n);
+}
+
+static gboolean for_fields(GArray* ranges, const gchar* s, const guint32* fields, field_cb cb, gpointer data)
+{
+    gint n = fields[0];
+    for (guint k = 0; k < ranges->len; k++)
+    {
+        gint from, to;
+        bounds_of(g_array_index(ranges, range_t, k), n, &from, &to);
+        for (gint i = from; i <= to; i++)
+        {
+            guint32 start = fields[2 * i - 1];
+            guint32 end   = fields[2 * i];
+            if (cb(s + start, end - start, data))
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+typedef struct
+{
+    GString* buf;
+    gboolean first;
+} join_t;
+
+static gboolean join_field(const gchar* s, gsize len, gpointer data)
+{
+    join_t* j = data;
+    if (!j->first)
+        g_string_append(j->buf, conf.field_delimiter ? conf.field_delimiter : " ");
+    j->first = FALSE;
+    g_string_append_len(j->buf, s, len);
+    return FALSE;
+}
+
+/* Append the selected fields to buf, separated by the field delimiter or,
+ * for blank separated fields, a space. */
+static void join(GString* buf, GArray* ranges, const gchar* s, const guint32* fields)
+{
+    join_t j = { buf, TRUE };
+    for_fields(ranges, s, fields, join_field, &j);
+}
+
+/* Split a freshly read line, and make its display string the --with-nth
+ * fields. Size, length and width are computed by the caller. */
+void fields_apply(line_t* line)
+{
+    line->fullstr = line->string;
+    line->fields  = split(line->string->str, line->string->len);
+    if (with_nth)
+    {
+        GString* d = g_string_new("");
+        join(d, with_nth, line->fullstr->str, line->fields);
+        line->string = d;
+    }
+}
+
+typedef struct
+{
+    const gchar*  base;
+    query_span_t* spans;
+    guint         n;
+} collect_t;
+
+static gboolean collect_field(const gchar* s, gsize len, gpointer data)
+{
+    collect_t* c = data;
+    c->spans[c->n].start = s - c->base;
+    c->spans[c->n].end   = s - c->base + len;
+    c->n++;
+    return FALSE;
+}
+
+/* Whether query matches the line, only looking into --nth fields. */
+gboolean fields_match(query_t* query, line_t* line)
+{
+    if (!nth || !line->fields)
+    {
+        query_span_t all = { 0, record_len(line->string->str, line->string->len) };
+        return query_match(query, line->string->str, &all, 1);
+    }
+    /*every range may select every field*/
+    gsize         most  = (gsize) nth->len * line->fields[0];
+    query_span_t  stack[64];
+    collect_t     c     = { line->fullstr->str, most <= 64 ? stack : g_new(query_span_t, most), 0 };
+    for_fields(nth, line->fullstr->str, line->fields, collect_field, &c);
+    gboolean      match = query_match(query, line->fullstr->str, c.spans, c.n);
+    if (c.spans != stack)
+        g_free(c.spans);
+    return match;
+}
+
+typedef struct
+{
+    query_hit_cb cb;
+    gpointer     data;
+    gsize        shift;
+} shift_t;
+
+static void shifted_hit(gsize start, gsize end, gpointer data)
+{
+    shift_t* sh = data;
+    sh->cb(sh->shift + start, sh->shift + end, sh->data);
+}
+
+/* Hits of query in the shown text of a line, only where fields_match()
+ * looks: in the --nth fields, wherever --with-nth shows them. Offsets
+ * are in line->string. */
+void fields_hits(query_t* query, line_t* line, query_hit_cb cb, gpointer data)
+{
+    const gchar* s = line->string->str;
+    if (!nth || !line->fields)
+    {
+        query_hits(query, s, record_len(s, line->string->len), cb, data);
+        return;
+    }
+    const gchar*    full     = line->fullstr->str;
+    const guint32*  fields   = line->fields;
+    gint            n        = fields[0];
+    gboolean*       searched = g_new0(gboolean, n + 1);
+    for (guint k = 0; k < nth->len; k++)
+    {
+        gint from, to;
+        bounds_of(g_array_index(nth, range_t, k), n, &from, &to);
+        for (gint i = from; i <= to; i++)
+            searched[i] = TRUE;
+    }
+
+    shift_t sh = { cb, data, 0 };
+    if (!with_nth)
+    {
+        for (gint i = 1; i <= n; i++)
+            if (searched[i])
+            {
+                sh.shift = fields[2 * i - 1];
+                query_hits(query, full + sh.shift, fields[2 * i] - sh.shift, shifted_hit, &sh);
+            }
+    }
+    else
+    {
+        /*walk the fields as join() lays them out*/
+        gsize    sep   = conf.field_delimiter ? delimiter_len : 1;
+        gsize    at    = 0;
+        gboolean first = TRUE;
+        for (guint k = 0; k < with_nth->len; k++)
+        {
+            gint from, to;
+            bounds_of(g_array_index(with_nth, range_t, k), n, &from, &to);
+            for (gint i = from; i <= to; i++)
+            {
+                if (!first)
+                    at += sep;
+                first = FALSE;
+                gsize len = fields[2 * i] - fields[2 * i - 1];
+                if (searched[i])
+                {
+                    sh.shift = at;
+                    query_hits(query, full + fields[2 * i - 1], len, shifted_hit, &sh);
+                }
+                at += len;
+            }
+        }
+    }
+    g_free(searched);
+}
+
+/* Append the --output-fields of a line, from its original bytes. */
+void fields_append_output(GString* buf, line_t* line)
+{
+    const gchar* s = line->realstr->str;
+    if (line->realstr == line->fullstr)
+        join(buf, output_fields, s, line->fields);
+    else
+    {
+        guint32* fields = split(s, line->realstr->len);
+        join(buf, output_fields, s, fields);
+        g_free(fields);
+    }
+}
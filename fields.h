@@ -0,0 +1,13 @@
+#pragma once
+
+#include "conf.h"
+#include "query.h"
+
+void     fields_init(void);
+gboolean fields_active(void);
+gboolean fields_output(void);
+void     fields_apply(line_t*);
+gboolean fields_match(query_t*, line_t*);
+void     fields_hits(query_t*, line_t*, query_hit_cb, gpointer);
+void     fields_append_output(GString*, line_t*);
+gboolean fields_nth(const gchar*, gsize, gint, gsize*, gsize*);
@@ -0,0 +1,298 @@
+#include "follow.h"
+#include "input.h"
+#include "util.h"
+#include "loop.h"
+#include "alloc.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+/*
+ * Inputs kept open after the initial load. Pipes are read without blocking
+ * and dropped at EOF; files are watched with inotify and read again from
+ * where they stopped whenever they change. A line is taken only once its
+ * terminator has arrived.
+ *
+ * Files are followed by name, like tail -F. Once a file is read to its
+ * end it is compared with what its name stands for now: a file that
+ * shrank was truncated and is read again from the start, and a name that
+ * leads to another file was rotated, so the new file is opened. The
+ * directory is watched as well, for a name that comes back after it was
+ * moved away.
+ */
+
+#define FILE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define DIR_EVENTS  (IN_CREATE | IN_MOVED_TO)
+
+typedef struct
+{
+    GIOChannel* channel;
+    gchar*      name;
+    GString*    partial;
+    gboolean    pipe;
+    gboolean    closed;
+    /*the last read got to the end of the input*/
+    gboolean    at_end;
+    gint        watch;
+} source_t;
+
+static GPtrArray* sources;
+static gint       inotify_fd = -1;
+static void     (*appended)(glong);
+static guint      backlog;
+
+static void set_up_channel(GIOChannel* channel, const gchar* name)
+{
+    adjust_channel_encoding(channel, name, conf.raw);
+    if (conf.delimiter == '\n')
+        g_io_channel_set_line_term(channel, NULL, -1);
+    else
+        g_io_channel_set_line_term(channel, &conf.delimiter, 1);
+}
+
+static gint watch(const gchar* path, guint32 events)
+{
+    gint wd = inotify_fd < 0 ? -1 : inotify_add_watch(inotify_fd, path, events);
+    if (wd < 0)
+        warn("can't watch `%s': %s", path, g_strerror(errno));
+    return wd;
+}
+
+void follow_add(GIOChannel* channel, const gchar* name, gboolean pipe)
+{
+    if (!channel)
+        fatal("can't read `%s'", name);
+    set_up_channel(channel, name);
+
+    if (!sources)
+        sources = g_ptr_array_new();
+    source_t* src = g_new(source_t, 1);
+    src->channel = channel;
+    src->name    = g_strdup(name);
+    src->partial = g_string_new("");
+    src->pipe    = pipe;
+    src->closed  = FALSE;
+    src->at_end  = FALSE;
+    src->watch   = -1;
+    g_ptr_array_add(sources, src);
+
+    if (pipe)
+        g_io_channel_set_flags(channel, G_IO_FLAG_NONBLOCK, NULL);
+    else
+    {
+        if (inotify_fd < 0)
+            inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        src->watch = watch(name, FILE_EVENTS);
+        gchar* dir = g_path_get_dirname(name);
+        watch(dir, DIR_EVENTS);
+        g_free(dir);
+    }
+}
+
+static gboolean is_terminated(GString* s)
+{
+    if (s->len == 0)
+        return FALSE;
+    gchar last = s->str[s->len - 1];
+    if (conf.delimiter != '\n')
+        return last == conf.delimiter;
+    return last == '\n' || last == '\r' || last == '\0' || g_str_has_suffix(s->str, "\xe2\x80\xa9");
+}
+
+/* The input ended without a terminator: what is left is the last line. */
+static void flush_partial(source_t* src)
+{
+    if (src->partial->len > 0)
+    {
+        GString* gstr = g_string_new(src->partial->str);
+        if (!append_line(gstr))
+            g_string_free(gstr, TRUE);
+    }
+    g_string_truncate(src->partial, 0);
+}
+
+static void close_source(source_t* src)
+{
+    flush_partial(src);
+    g_string_free(src->partial, TRUE);
+    loop_remove_fd(g_io_channel_unix_get_fd(src->channel));
+    g_io_channel_shutdown(src->channel, FALSE, NULL);
+    g_io_channel_unref(src->channel);
+    src->closed = TRUE;
+}
+
+static guint read_source(source_t* src, guint budget)
+{
+    guint     added  = 0;
+    GIOStatus status = G_IO_STATUS_NORMAL;
+    GString*  gstr = g_string_new("");
+    while (added < budget && (status = g_io_channel_read_line_string(src->channel, gstr, NULL, NULL)) == G_IO_STATUS_NORMAL)
+    {
+        if (!is_terminated(gstr))
+        {
+            g_string_append_len(src->partial, gstr->str, gstr->len);
+            continue;
+        }
+        if (src->partial->len > 0)
+        {
+            g_string_prepend_len(gstr, src->partial->str, src->partial->len);
+            g_string_truncate(src->partial, 0);
+        }
+        if (append_line(gstr))
+        {
+            added++;
+            gstr = g_string_new("");
+        }
+    }
+    g_string_free(gstr, TRUE);
+
+    src->at_end = added < budget && status == G_IO_STATUS_EOF;
+    if (added < budget && status == G_IO_STATUS_ERROR)
+    {
+        warn("error while reading `%s' occured", src->name);
+        close_source(src);
+    }
+    else if (added < budget && status == G_IO_STATUS_EOF && src->pipe)
+        close_source(src);
+    return added;
+}
+
+/* A file read to its end: start over if it was truncated, or switch to
+ * the file that now has its name if it was rotated. Returns TRUE when
+ * there is something new to read. */
+static gboolean check_file(source_t* src)
+{
+    gint        fd = g_io_channel_unix_get_fd(src->channel);
+    struct stat was, now;
+    if (fstat(fd, &was) < 0)
+        return FALSE;
+    if (stat(src->name, &now) == 0 && (now.st_ino != was.st_ino || now.st_dev != was.st_dev))
+    {
+        GIOChannel* channel = g_io_channel_new_file(src->name, "r", NULL);
+        if (!channel)
+            return FALSE;
+        flush_partial(src);
+        g_io_channel_shutdown(src->channel, FALSE, NULL);
+        g_io_channel_unref(src->channel);
+        set_up_channel(channel, src->name);
+        src->channel = channel;
+        if (src->watch >= 0)
+            inotify_rm_watch(inotify_fd, src->watch);
+        src->watch = watch(src->name, FILE_EVENTS);
+        return TRUE;
+    }
+    if (was.st_size < lseek(fd, 0, SEEK_CUR))
+    {
+        g_string_truncate(src->partial, 0);
+        return g_io_channel_seek_position(src->channel, 0, G_SEEK_SET, NULL) == G_IO_STATUS_NORMAL;
+    }
+    return FALSE;
+}
+
+/* Read up to budget new lines from all inputs. */
+guint follow_read(guint budget)
+{
+    gint phase = alloc_phase("load");
+    if (inotify_fd >= 0)
+    {
+        gchar events[4096];
+        while (read(inotify_fd, events, sizeof(events)) > 0);
+    }
+    guint added = 0;
+    for (guint i = 0; sources && i < sources->len && added < budget; i++)
+    {
+        source_t* src = g_ptr_array_index(sources, i);
+        if (src->closed)
+            continue;
+        added += read_source(src, budget - added);
+        if (!src->pipe && src->at_end && check_file(src))
+            added += read_source(src, budget - added);
+    }
+    alloc_restore(phase);
+    return added;
+}
+
+gboolean follow_active(void)
+{
+    for (guint i = 0; sources && i < sources->len; i++)
+        if (!((source_t*) g_ptr_array_index(sources, i))->closed)
+            return TRUE;
+    return FALSE;
+}
+
+/* Fill fds with descriptors that become readable when there is input. */
+static guint follow_fds(struct pollfd* fds, guint max)
+{
+    guint n = 0;
+    if (inotify_fd >= 0 && n < max)
+    {
+        fds[n].fd     = inotify_fd;
+        fds[n].events = POLLIN;
+        n++;
+    }
+    for (guint i = 0; sources && i < sources->len && n < max; i++)
+    {
+        source_t* src = g_ptr_array_index(sources, i);
+        if (src->pipe && !src->closed)
+        {
+            fds[n].fd     = g_io_channel_unix_get_fd(src->channel);
+            fds[n].events = POLLIN;
+            n++;
+        }
+    }
+    return n;
+}
+
+/* Initial load: read what is there, then wait until there is something. */
+void follow_wait(void)
+{
+    follow_read(G_MAXUINT);
+    while (SL == 0 && follow_active())
+    {
+        struct pollfd fds[16];
+        guint n = follow_fds(fds, G_N_ELEMENTS(fds));
+        if (poll(fds, n, -1) < 0 && errno != EINTR)
+            fatal("poll failed: %s", g_strerror(errno));
+        follow_read(G_MAXUINT);
+    }
+}
+
+static gboolean on_backlog(gpointer);
+
+/* Read one batch; if there may be more, come back on the next iteration
+ * rather than holding up the keyboard. */
+static void read_batch(void)
+{
+    glong first = SL;
+    guint added = follow_read(FOLLOW_BATCH);
+    if (SL > first)
+        appended(first);
+    if (added == FOLLOW_BATCH && !backlog)
+        backlog = loop_add_idle(on_backlog, NULL);
+}
+
+static gboolean on_backlog(G_GNUC_UNUSED gpointer data)
+{
+    backlog = 0;
+    read_batch();
+    return FALSE;
+}
+
+static void on_ready(G_GNUC_UNUSED gint fd, G_GNUC_UNUSED gpointer data)
+{
+    read_batch();
+}
+
+/* Hand followed inputs over to the event loop; on_lines is told about
+ * every batch of appended lines. */
+void follow_start(void (*on_lines)(glong))
+{
+    appended = on_lines;
+    struct pollfd fds[16];
+    guint n = follow_fds(fds, G_N_ELEMENTS(fds));
+    for (guint i = 0; i < n; i++)
+        loop_add_fd(fds[i].fd, on_ready, NULL);
+}
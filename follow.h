@@ -0,0 +1,12 @@
+#pragma once
+
+#include "conf.h"
+
+/*lines read from followed inputs between two looks at the keyboard*/
+#define FOLLOW_BATCH 4096
+
+void     follow_add(GIOChannel*, const gchar*, gboolean);
+void     follow_wait(void);
+gboolean follow_active(void);
+guint    follow_read(guint);
+void     follow_start(void (*)(glong));
@@ -0,0 +1,116 @@
+#include <string.h>
+
+#include "highlight.h"
+#include "util.h"
+#include "fields.h"
+
+/*
+ * Match spans for highlighting. They are computed when a line is drawn,
+ * so only for visible rows, and kept per line until the query changes.
+ * Byte offsets of the matches are turned into display columns with the
+ * same width code the line is drawn with. With --nth only the fields the
+ * search looks into are highlighted.
+ */
+
+/*lines whose spans are kept at most; the cache is emptied beyond that*/
+#define HIGHLIGHT_CACHE 4096
+
+static GHashTable* spans;
+/*query_text() of the query the spans are for*/
+static gchar*      key;
+
+static void free_spans(gpointer data)
+{
+    g_array_free(data, TRUE);
+}
+
+static glong width_between(const gchar* p, const gchar* end)
+{
+    if (conf.raw)
+        return end - p;
+    glong width = 0;
+    gunichar c;
+    while (p < end && *p)
+    {
+        p += utf8_decode(p, &c);
+        width += gunichar_width(c);
+    }
+    return width;
+}
+
+static gint by_start(gconstpointer a, gconstpointer b)
+{
+    const query_span_t* x = a;
+    const query_span_t* y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static void add_hit(gsize start, gsize end, gpointer data)
+{
+    query_span_t hit = { start, end };
+    if (end > start)
+        g_array_append_val((GArray*) data, hit);
+}
+
+/* Hits of all terms in byte offsets, sorted and merged where they
+ * overlap, then turned into columns in one pass over the line. */
+static GArray* find_spans(query_t* query, line_t* line)
+{
+    GArray*      hits   = g_array_new(FALSE, FALSE, sizeof(query_span_t));
+    GArray*      result = g_array_new(FALSE, FALSE, sizeof(span_t));
+    const gchar* str    = line->string->str;
+    fields_hits(query, line, add_hit, hits);
+    g_array_sort(hits, by_start);
+
+    const gchar* last = str;
+    glong        col  = 0;
+    for (guint i = 0; i < hits->len; i++)
+    {
+        query_span_t h = g_array_index(hits, query_span_t, i);
+        while (i + 1 < hits->len && g_array_index(hits, query_span_t, i + 1).start <= h.end)
+            h.end = MAX(h.end, g_array_index(hits, query_span_t, ++i).end);
+        if (str + h.start < last)
+            h.start = last - str;
+        span_t span;
+        col       += width_between(last, str + h.start);
+        span.start = col;
+        col       += width_between(str + h.start, str + h.end);
+        span.end   = col;
+        last       = str + h.end;
+        if (span.end > span.start)
+            g_array_append_val(result, span);
+    }
+    g_array_free(hits, TRUE);
+    return result;
+}
+
+/* Forget all spans; the lines are about to be replaced. */
+void highlight_reset(void)
+{
+    if (spans)
+        g_hash_table_remove_all(spans);
+}
+
+/* Spans of query in the line at index, in order. NULL without a query. */
+GArray* highlight_spans(query_t* query, glong index)
+{
+    if (!query)
+        return NULL;
+    if (!spans)
+        spans = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free_spans);
+    if (g_strcmp0(key, query_text(query)) || g_hash_table_size(spans) >= HIGHLIGHT_CACHE)
+    {
+        g_hash_table_remove_all(spans);
+        g_free(key);
+        key = g_strdup(query_text(query));
+    }
+
+    line_t* line   = get_line_t(index);
+    GArray* result = g_hash_table_lookup(spans, line);
+    if (!result)
+    {
+        result = find_spans(query, line);
+        g_hash_table_insert(spans, line, result);
+    }
+    return result;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "conf.h"
+#include "query.h"
+
+/*a match, in display columns of the line*/
+typedef struct
+{
+    glong start;
+    glong end;
+} span_t;
+
+GArray* highlight_spans(query_t*, glong);
+void    highlight_reset(void);
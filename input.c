@@ -0,0 +1,510 @@
+#include "input.h"
+#include "util.h"
+#include "alloc.h"
+#include "fields.h"
+#include "preselect.h"
+#include "ansi.h"
+
+#include <string.h>
+#include <errno.h>
+
+#define CHAR_VT 0x000bu
+
+void adjust_channel_encoding(GIOChannel* channel, const gchar* name, gboolean binary)
+{
+    GIOStatus   status;
+    const char* charset;
+    if (!binary)
+        g_get_charset(&charset);
+    else
+        charset = NULL;
+    status = g_io_channel_set_encoding(channel, charset, NULL);
+    if (status != G_IO_STATUS_NORMAL)
+        fatal("can't set encoding `%s' for `%s'", charset == NULL? "binary" : charset, name);
+}
+
+/* --raw: the bytes are kept as they are, each one column wide. */
+static line_t* make_raw_line(GString* gstr)
+{
+    gsize    len      = record_len(gstr->str, gstr->len);
+    gboolean is_white = TRUE;
+    for (gsize i = 0; i < len && is_white; i++)
+        is_white = g_ascii_isspace(gstr->str[i]);
+    if (is_white && !conf.whitelines)
+        return NULL;
+
+    line_t* line = g_new(line_t, 1);
+    line->checked = conf.initial;
+    line->realstr = gstr;
+    line->string  = gstr;
+    line->fullstr = gstr;
+    line->fields  = NULL;
+    line->runs    = NULL;
+    if (fields_active())
+        fields_apply(line);
+    line->size    = line->string->len;
+    line->length  = record_len(line->string->str, line->string->len);
+    line->width   = line->length;
+    line->white   = is_white;
+    line->checkpoints = NULL;
+    if (preselect_line(line))
+        line->checked = TRUE;
+    return line;
+}
+
+/* Process one line read from an input. Returns NULL if the line is to be
+ * skipped. Touches no shared state, so workers may call it. */
+static line_t* make_line(GString* gstr)
+{
+    if (conf.raw)
+        return make_raw_line(gstr);
+    gboolean is_white = TRUE;
+    gunichar c;
+    gchar*   p = gstr->str;
+    while (*p)
+    {
+        c = g_utf8_get_char(p);
+        p = g_utf8_next_char(p);
+        if (!g_unichar_isspace(c) && !(c == CHAR_VT) ) /*vertical tabulation is «space» symbol too*/
+        {
+            is_white = FALSE;
+            break;
+        }
+    }
+    if (is_white && !conf.whitelines)
+        return NULL;
+
+    line_t* line = g_new(line_t, 1);
+    line->runs   = NULL;
+
+    /*--ansi: colors become runs, the rest of the text is the line*/
+    GString* text = conf.ansi ? ansi_strip(gstr, &line->runs) : gstr;
+    gchar*  norm = g_utf8_normalize(text->str, text->len, G_NORMALIZE_ALL_COMPOSE);
+    GString* ns;
+    if (g_strcmp0(text->str, norm) == 0)
+        ns = text;
+    else
+    {
+        ns = g_string_new(norm);
+        if (text != gstr)
+            g_string_free(text, TRUE);
+    }
+    g_free(norm);
+
+    line->checked = conf.initial;
+    line->realstr = gstr;
+    line->string  = ns;
+    line->fullstr = ns;
+    line->fields  = NULL;
+    if (fields_active())
+        fields_apply(line);
+    ns = line->string;
+    line->size    = ns->len;
+    line->length  = g_utf8_strlen(ns->str, ns->len);
+    line->width   = g_utf8_strwidth(ns->str);
+    line->white   = is_white;
+    line->checkpoints = NULL;
+    if (preselect_line(line))
+        line->checked = TRUE;
+    return line;
+}
+
+/*where lines read go: strings, or a list being loaded in the background*/
+typedef struct
+{
+    GPtrArray* lines;
+    guint*     widest;
+    /*first error, when they are collected rather than fatal*/
+    gchar**    error;
+} sink_t;
+
+static GMutex fail_lock;
+
+/* A reading error: fatal, or kept for the caller if the sink collects
+ * them. Takes message. */
+static void fail(sink_t* sink, gchar* message)
+{
+    if (!sink->error)
+        fatal("%s", message);
+    g_mutex_lock(&fail_lock);
+    if (!*sink->error)
+        *sink->error = message;
+    else
+        g_free(message);
+    g_mutex_unlock(&fail_lock);
+}
+
+static void add_line(sink_t* sink, line_t* line)
+{
+    if (line->width > *sink->widest)
+        *sink->widest = line->width;
+    g_ptr_array_add(sink->lines, line);
+}
+
+/* Process one line read from an input and add it to strings. Returns FALSE
+ * if the line was skipped; the caller keeps ownership of gstr then. */
+gboolean append_line(GString* gstr)
+{
+    sink_t  sink = { strings, &max_string_width, NULL };
+    line_t* line = make_line(gstr);
+    if (!line)
+        return FALSE;
+    add_line(&sink, line);
+    return TRUE;
+}
+
+/* Free a line made by make_line(). Lines of cache snapshots are not. */
+void free_line(line_t* line)
+{
+    if (line->fullstr != line->string && line->fullstr != line->realstr)
+        g_string_free(line->fullstr, TRUE);
+    if (line->string != line->realstr)
+        g_string_free(line->string, TRUE);
+    g_string_free(line->realstr, TRUE);
+    if (line->checkpoints)
+        g_array_free(line->checkpoints, TRUE);
+    g_free(line->fields);
+    g_free(line->runs);
+    g_free(line);
+}
+
+#define READ_BLOCK (1 << 20)
+
+static GIConv open_conv(sink_t* sink, const gchar* name)
+{
+    const gchar* charset;
+    GIConv conv = (GIConv)(-1);
+    if (!conf.raw && !g_get_charset(&charset))
+    {
+        conv = g_iconv_open("UTF-8", charset);
+        if (conv == (GIConv)(-1))
+            fail(sink, g_strdup_printf("can't set encoding `%s' for `%s'", charset, name));
+    }
+    return conv;
+}
+
+/* Bring a record to UTF-8. Returns FALSE if it can't be, and errors are
+ * collected; the record is dropped then. */
+static gboolean to_utf8(sink_t* sink, GString* gstr, const gchar* name, GIConv conv)
+{
+    if (conv != (GIConv)(-1))
+    {
+        gsize  written;
+        gchar* utf8 = g_convert_with_iconv(gstr->str, gstr->len, conv, NULL, &written, NULL);
+        if (!utf8)
+        {
+            fail(sink, g_strdup_printf("can't convert `%s' to UTF-8", name));
+            return FALSE;
+        }
+        g_string_truncate(gstr, 0);
+        g_string_append_len(gstr, utf8, written);
+        g_free(utf8);
+    }
+    else if (!conf.raw && !g_utf8_validate(gstr->str, -1, NULL))
+    {
+        fail(sink, g_strdup_printf("error while reading `%s' occured", name));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Bring a record to UTF-8 and add its line to sink. Returns the string
+ * to collect the next record into. */
+static GString* take_record(sink_t* sink, GString* gstr, const gchar* name, GIConv conv)
+{
+    line_t* line = to_utf8(sink, gstr, name, conv) ? make_line(gstr) : NULL;
+    if (line)
+    {
+        add_line(sink, line);
+        return g_string_new("");
+    }
+    g_string_truncate(gstr, 0);
+    return gstr;
+}
+
+/* Read fd in large blocks and split it on conf.delimiter with memchr. Each
+ * record keeps its delimiter, as lines keep their terminators. */
+static void read_serial(sink_t* sink, gint fd, const gchar* name)
+{
+    GIConv conv = open_conv(sink, name);
+
+    gchar*   buf  = g_malloc(READ_BLOCK);
+    GString* gstr = g_string_new("");
+    ssize_t  n;
+    while ((n = read(fd, buf, READ_BLOCK)) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fail(sink, g_strdup_printf("error while reading `%s' occured", name));
+            break;
+        }
+        gchar* p   = buf;
+        gchar* end = buf + n;
+        gchar* d;
+        while ((d = memchr(p, conf.delimiter, end - p)))
+        {
+            g_string_append_len(gstr, p, d + 1 - p);
+            gstr = take_record(sink, gstr, name, conv);
+            p = d + 1;
+        }
+        g_string_append_len(gstr, p, end - p);
+    }
+    if (gstr->len > 0)
+        gstr = take_record(sink, gstr, name, conv);
+
+    g_string_free(gstr, TRUE);
+    g_free(buf);
+    if (conv != (GIConv)(-1))
+        g_iconv_close(conv);
+    close(fd);
+}
+
+/*
+ * Parallel reading. A reader thread cuts the input into blocks that end at
+ * a delimiter, workers turn blocks into batches of lines, and the calling
+ * thread appends the batches to strings in input order. Blocks are limited
+ * to 2 per worker from the moment they are read until their lines are
+ * appended, which bounds memory however fast the input or slow the
+ * workers are.
+ */
+
+typedef struct
+{
+    GMutex   lock;
+    GCond    cond;
+    GQueue   items;
+    guint    capacity;
+    gboolean closed;
+} queue_t;
+
+typedef struct
+{
+    guint64 seq;
+    gchar*  data;
+    gsize   len;
+} block_t;
+
+typedef struct
+{
+    guint64    seq;
+    GPtrArray* lines;
+} batch_t;
+
+typedef struct
+{
+    gint         fd;
+    const gchar* name;
+    sink_t*      sink;
+    queue_t      slots;
+    queue_t      blocks;
+    queue_t      batches;
+} pipeline_t;
+
+/*pushed to batches by a worker that is done*/
+static batch_t worker_done;
+
+static void queue_init(queue_t* q, guint capacity)
+{
+    g_mutex_init(&q->lock);
+    g_cond_init(&q->cond);
+    g_queue_init(&q->items);
+    q->capacity = capacity;
+    q->closed   = FALSE;
+}
+
+static void queue_clear(queue_t* q)
+{
+    g_queue_clear(&q->items);
+    g_cond_clear(&q->cond);
+    g_mutex_clear(&q->lock);
+}
+
+static void queue_push(queue_t* q, gpointer item)
+{
+    g_mutex_lock(&q->lock);
+    while (q->capacity && q->items.length >= q->capacity)
+        g_cond_wait(&q->cond, &q->lock);
+    g_queue_push_tail(&q->items, item);
+    g_cond_broadcast(&q->cond);
+    g_mutex_unlock(&q->lock);
+}
+
+/* NULL once the queue is closed and empty. */
+static gpointer queue_pop(queue_t* q)
+{
+    g_mutex_lock(&q->lock);
+    while (q->items.length == 0 && !q->closed)
+        g_cond_wait(&q->cond, &q->lock);
+    gpointer item = g_queue_pop_head(&q->items);
+    g_cond_broadcast(&q->cond);
+    g_mutex_unlock(&q->lock);
+    return item;
+}
+
+static void queue_close(queue_t* q)
+{
+    g_mutex_lock(&q->lock);
+    q->closed = TRUE;
+    g_cond_broadcast(&q->cond);
+    g_mutex_unlock(&q->lock);
+}
+
+static gpointer reader(gpointer data)
+{
+    alloc_phase("load");
+    pipeline_t* pl  = data;
+    GString*    acc = g_string_sized_new(READ_BLOCK);
+    guint64     seq = 0;
+    ssize_t     n;
+    do
+    {
+        gsize old = acc->len;
+        g_string_set_size(acc, old + READ_BLOCK);
+        while ((n = read(pl->fd, acc->str + old, READ_BLOCK)) < 0 && errno == EINTR);
+        if (n < 0)
+        {
+            /*taken as the end of the input*/
+            fail(pl->sink, g_strdup_printf("error while reading `%s' occured", pl->name));
+            n = 0;
+        }
+        g_string_set_size(acc, old + n);
+
+        /*cut after the last delimiter, or take the rest at the end*/
+        gsize cut = acc->len;
+        if (n > 0)
+            while (cut > 0 && acc->str[cut - 1] != conf.delimiter)
+                cut--;
+        if (cut == 0)
+            continue;
+
+        queue_pop(&pl->slots);
+        block_t* block = g_new(block_t, 1);
+        block->seq  = seq++;
+        block->data = g_memdup2(acc->str, cut);
+        block->len  = cut;
+        queue_push(&pl->blocks, block);
+        g_string_erase(acc, 0, cut);
+    }
+    while (n > 0);
+
+    g_string_free(acc, TRUE);
+    queue_close(&pl->blocks);
+    return NULL;
+}
+
+static gpointer worker(gpointer data)
+{
+    alloc_phase("load");
+    pipeline_t* pl   = data;
+    GIConv      conv = open_conv(pl->sink, pl->name);
+    block_t*    block;
+    while ((block = queue_pop(&pl->blocks)))
+    {
+        batch_t* batch = g_new(batch_t, 1);
+        batch->seq   = block->seq;
+        batch->lines = g_ptr_array_new();
+
+        gchar* p   = block->data;
+        gchar* end = block->data + block->len;
+        while (p < end)
+        {
+            gchar* d = memchr(p, conf.delimiter, end - p);
+            gchar* next = d ? d + 1 : end;
+            GString* gstr = g_string_new_len(p, next - p);
+            line_t* line = to_utf8(pl->sink, gstr, pl->name, conv) ? make_line(gstr) : NULL;
+            if (line)
+                g_ptr_array_add(batch->lines, line);
+            else
+                g_string_free(gstr, TRUE);
+            p = next;
+        }
+        queue_push(&pl->batches, batch);
+        g_free(block->data);
+        g_free(block);
+    }
+    if (conv != (GIConv)(-1))
+        g_iconv_close(conv);
+    queue_push(&pl->batches, &worker_done);
+    return NULL;
+}
+
+static void read_parallel(sink_t* sink, gint fd, const gchar* name, guint threads)
+{
+    pipeline_t pl;
+    pl.fd   = fd;
+    pl.name = name;
+    pl.sink = sink;
+    queue_init(&pl.slots,   0);
+    queue_init(&pl.blocks,  0);
+    queue_init(&pl.batches, 0);
+    for (guint i = 0; i < 2 * threads; i++)
+        queue_push(&pl.slots, GUINT_TO_POINTER(1));
+
+    GThread*  read_thread = g_thread_new("reader", reader, &pl);
+    GThread** workers     = g_new(GThread*, threads);
+    for (guint i = 0; i < threads; i++)
+        workers[i] = g_thread_new("worker", worker, &pl);
+
+    /*batches that arrived ahead of their turn*/
+    GHashTable* ahead = g_hash_table_new(g_int64_hash, g_int64_equal);
+    guint64     next  = 0;
+    guint       done  = 0;
+    while (done < threads)
+    {
+        batch_t* batch = queue_pop(&pl.batches);
+        if (batch == &worker_done)
+        {
+            done++;
+            continue;
+        }
+        g_hash_table_insert(ahead, &batch->seq, batch);
+        while ((batch = g_hash_table_lookup(ahead, &next)))
+        {
+            g_hash_table_remove(ahead, &next);
+            for (guint i = 0; i < batch->lines->len; i++)
+                add_line(sink, g_ptr_array_index(batch->lines, i));
+            g_ptr_array_free(batch->lines, TRUE);
+            g_free(batch);
+            queue_push(&pl.slots, GUINT_TO_POINTER(1));
+            next++;
+        }
+    }
+
+    g_thread_join(read_thread);
+    for (guint i = 0; i < threads; i++)
+        g_thread_join(workers[i]);
+    g_free(workers);
+    g_hash_table_destroy(ahead);
+    queue_clear(&pl.slots);
+    queue_clear(&pl.blocks);
+    queue_clear(&pl.batches);
+}
+
+/* Read fd into lines, keeping the widest width in widest. With error,
+ * reading errors don't end chooser: the first one is put there and the
+ * records it spoiled are dropped. */
+void read_input_into(gint fd, const gchar* name, GPtrArray* lines, guint* widest, gchar** error)
+{
+    sink_t sink    = { lines, widest, error };
+    if (fd < 0)
+    {
+        fail(&sink, g_strdup_printf("can't read `%s'", name));
+        return;
+    }
+
+    guint  threads = conf.threads > 0 ? (guint) conf.threads : MIN(g_get_num_processors(), 16);
+    if (threads > 1)
+    {
+        read_parallel(&sink, fd, name, threads);
+        close(fd);
+    }
+    else
+        read_serial(&sink, fd, name);
+}
+
+void read_input(gint fd, const gchar* name)
+{
+    read_input_into(fd, name, strings, &max_string_width, NULL);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "conf.h"
+
+void     adjust_channel_encoding(GIOChannel*, const gchar*, gboolean);
+gboolean append_line(GString*);
+void     read_input(gint, const gchar*);
+void     read_input_into(gint, const gchar*, GPtrArray*, guint*, gchar**);
+void     free_line(line_t*);
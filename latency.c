@@ -0,0 +1,129 @@
+#include <stdio.h>
+
+#include "latency.h"
+#include "util.h"
+
+/*
+ * Key latency log, enabled with --latency-log. Each key is stamped when
+ * it is read from the terminal and is settled by the end of the next
+ * frame, which is when the key's effect reached the terminal. A key that
+ * asks for no frame is settled once it has been handled, with 0 bytes.
+ * The log has a line per key: its code, the latency in microseconds, and
+ * the bytes the frame wrote to the terminal. Keys typed at the search
+ * prompt are logged as -1. A summary with percentiles follows when the
+ * session ends.
+ *
+ * Bytes are taken from wchar in /proc/self/io, which counts every write of
+ * the process; nothing but the terminal is written during a frame.
+ */
+
+typedef struct
+{
+    gint    key;
+    gint64  time;
+} stamp_t;
+
+static FILE*   out;
+static GArray* pending;
+static GArray* latencies;
+static gint64  wchar_before;
+static gint64  bytes_total;
+
+static gint64 get_wchar(void)
+{
+    gint64 wchar = -1;
+    FILE*  f     = fopen("/proc/self/io", "r");
+    if (!f)
+        return -1;
+    gchar line[64];
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "wchar: %" G_GINT64_FORMAT, &wchar) == 1)
+            break;
+    fclose(f);
+    return wchar;
+}
+
+void latency_open(const gchar* path)
+{
+    out = fopen(path, "w");
+    if (!out)
+        fatal("can't open %s", path);
+    pending   = g_array_new(FALSE, FALSE, sizeof(stamp_t));
+    latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+}
+
+void latency_key(gint key)
+{
+    if (!out)
+        return;
+    stamp_t s = { key, g_get_monotonic_time() };
+    g_array_append_val(pending, s);
+}
+
+void latency_frame_begin(void)
+{
+    if (out && pending->len > 0)
+        wchar_before = get_wchar();
+}
+
+static void settle(gint64 bytes)
+{
+    gint64 now = g_get_monotonic_time();
+    for (guint i = 0; i < pending->len; i++)
+    {
+        stamp_t* s = &g_array_index(pending, stamp_t, i);
+        gint64   l = now - s->time;
+        g_array_append_val(latencies, l);
+        fprintf(out, "%d %" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n", s->key, l, bytes);
+    }
+    g_array_set_size(pending, 0);
+}
+
+void latency_frame_end(void)
+{
+    if (!out || pending->len == 0)
+        return;
+    fflush(stdout);
+    gint64 wchar = get_wchar();
+    gint64 bytes = wchar >= 0 && wchar_before >= 0 ? wchar - wchar_before : -1;
+    if (bytes > 0)
+        bytes_total += bytes;
+    settle(bytes);
+}
+
+/* Keys were handled and no frame is coming for them. */
+void latency_keys_done(void)
+{
+    if (out && pending->len > 0)
+        settle(0);
+}
+
+static gint cmp_gint64(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64*) a;
+    gint64 y = *(const gint64*) b;
+    return x < y ? -1 : x > y;
+}
+
+static gint64 percentile(guint p)
+{
+    guint i = (latencies->len - 1) * p / 100;
+    return g_array_index(latencies, gint64, i);
+}
+
+void latency_close(void)
+{
+    if (!out)
+        return;
+    if (latencies->len > 0)
+    {
+        g_array_sort(latencies, cmp_gint64);
+        fprintf(out, "# keys %u p50 %" G_GINT64_FORMAT " p90 %" G_GINT64_FORMAT " p99 %" G_GINT64_FORMAT
+                " max %" G_GINT64_FORMAT " us, %" G_GINT64_FORMAT " bytes\n",
+                latencies->len, percentile(50), percentile(90), percentile(99), percentile(100), bytes_total);
+    }
+    fclose(out);
+    out = NULL;
+    g_array_free(pending, TRUE);
+    g_array_free(latencies, TRUE);
+}
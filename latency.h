@@ -0,0 +1,10 @@
+#pragma once
+
+#include "conf.h"
+
+void latency_open(const gchar*);
+void latency_key(gint);
+void latency_frame_begin(void);
+void latency_frame_end(void);
+void latency_keys_done(void);
+void latency_close(void);
@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include "loop.h"
+#include "util.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+
+/*
+ * The event loop of an interactive session. It waits in ppoll() on the
+ * watched descriptors (the terminal, followed inputs), on an eventfd that
+ * other threads use to hand work back to the main thread, and until the
+ * next timer is due. SIGWINCH is blocked everywhere except inside ppoll(),
+ * so a resize always interrupts the wait and is never lost between two
+ * waits; ncurses reports it as KEY_RESIZE on the next read.
+ *
+ * Handlers only change state and ask for a frame; the screen is rendered
+ * once per iteration, before waiting again, and at most once per
+ * FRAME_INTERVAL. A frame asked for sooner is delayed, so bursts of input
+ * collapse into it.
+ */
+
+#define FRAME_INTERVAL (G_USEC_PER_SEC / 60)
+
+typedef struct
+{
+    gint       fd;
+    loop_fd_cb cb;
+    gpointer   data;
+} watch_t;
+
+typedef struct
+{
+    guint         id;
+    gint64        due;
+    glong         interval;
+    loop_timer_cb cb;
+    gpointer      data;
+} timer_t_;
+
+typedef struct
+{
+    loop_invoke_cb cb;
+    gpointer       data;
+} invocation_t;
+
+static GArray*      watches;
+static GArray*      timers;
+static guint        last_timer_id;
+static GAsyncQueue* invocations;
+static gint         wake_fd = -1;
+static loop_fd_cb   signal_cb;
+static gpointer     signal_data;
+static gboolean     frame_needed;
+static gint64       last_frame;
+static gboolean     quit;
+
+static void init(void)
+{
+    if (watches)
+        return;
+    watches     = g_array_new(FALSE, FALSE, sizeof(watch_t));
+    timers      = g_array_new(FALSE, FALSE, sizeof(timer_t_));
+    invocations = g_async_queue_new();
+    wake_fd     = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0)
+        fatal("can't create eventfd: %s", g_strerror(errno));
+}
+
+void loop_add_fd(gint fd, loop_fd_cb cb, gpointer data)
+{
+    init();
+    watch_t w = { fd, cb, data };
+    g_array_append_val(watches, w);
+}
+
+void loop_remove_fd(gint fd)
+{
+    for (guint i = 0; watches && i < watches->len; i++)
+        if (g_array_index(watches, watch_t, i).fd == fd)
+            g_array_remove_index(watches, i--);
+}
+
+/* Called when the wait was interrupted by a signal (SIGWINCH). */
+void loop_on_signal(loop_fd_cb cb, gpointer data)
+{
+    signal_cb   = cb;
+    signal_data = data;
+}
+
+/* Call cb every interval microseconds until it returns FALSE. */
+guint loop_add_timer(glong interval, loop_timer_cb cb, gpointer data)
+{
+    init();
+    timer_t_ t = { ++last_timer_id, g_get_monotonic_time() + interval, interval, cb, data };
+    g_array_append_val(timers, t);
+    return t.id;
+}
+
+/* Call cb on every iteration, without waiting, until it returns FALSE. */
+guint loop_add_idle(loop_timer_cb cb, gpointer data)
+{
+    return loop_add_timer(0, cb, data);
+}
+
+void loop_remove_timer(guint id)
+{
+    for (guint i = 0; timers && i < timers->len; i++)
+        if (g_array_index(timers, timer_t_, i).id == id)
+            g_array_remove_index(timers, i--);
+}
+
+/* Run cb on the main thread. Safe to call from any thread. */
+void loop_invoke(loop_invoke_cb cb, gpointer data)
+{
+    invocation_t* inv = g_new(invocation_t, 1);
+    inv->cb   = cb;
+    inv->data = data;
+    g_async_queue_push(invocations, inv);
+    guint64 one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        warn("can't wake event loop: %s", g_strerror(errno));
+}
+
+void loop_request_frame(void)
+{
+    frame_needed = TRUE;
+}
+
+gboolean loop_frame_requested(void)
+{
+    return frame_needed;
+}
+
+void loop_quit(void)
+{
+    quit = TRUE;
+}
+
+static gint next_timeout(void)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 due = frame_needed ? last_frame + FRAME_INTERVAL : G_MAXINT64;
+    if (timers->len == 0 && !frame_needed)
+        return -1;
+    for (guint i = 0; i < timers->len; i++)
+        due = MIN(due, g_array_index(timers, timer_t_, i).due);
+    if (due <= now)
+        return 0;
+    return (due - now + 999) / 1000;
+}
+
+static gint find_timer(guint id)
+{
+    for (guint i = 0; i < timers->len; i++)
+        if (g_array_index(timers, timer_t_, i).id == id)
+            return i;
+    return -1;
+}
+
+static void run_timers(void)
+{
+    gint64 now = g_get_monotonic_time();
+    GArray* due = g_array_new(FALSE, FALSE, sizeof(guint));
+    for (guint i = 0; i < timers->len; i++)
+        if (g_array_index(timers, timer_t_, i).due <= now)
+            g_array_append_val(due, g_array_index(timers, timer_t_, i).id);
+
+    /*callbacks may add and remove timers, so look each one up again*/
+    for (guint k = 0; k < due->len && !quit; k++)
+    {
+        gint i = find_timer(g_array_index(due, guint, k));
+        if (i < 0)
+            continue;
+        timer_t_ t = g_array_index(timers, timer_t_, i);
+        gboolean again = t.cb(t.data);
+        i = find_timer(t.id);
+        if (i < 0)
+            continue;
+        if (again)
+            g_array_index(timers, timer_t_, i).due = now + t.interval;
+        else
+            g_array_remove_index(timers, i);
+    }
+    g_array_free(due, TRUE);
+}
+
+static void run_invocations(void)
+{
+    guint64 count;
+    while (read(wake_fd, &count, sizeof(count)) > 0);
+    invocation_t* inv;
+    while ((inv = g_async_queue_try_pop(invocations)))
+    {
+        inv->cb(inv->data);
+        g_free(inv);
+    }
+}
+
+void loop_run(void (*render)(void))
+{
+    init();
+    sigset_t block, orig, waitmask;
+    sigemptyset(&block);
+    sigaddset(&block, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &block, &orig);
+    waitmask = orig;
+    sigdelset(&waitmask, SIGWINCH);
+
+    quit = FALSE;
+    GArray* fds = g_array_new(FALSE, FALSE, sizeof(struct pollfd));
+    while (!quit)
+    {
+        if (frame_needed && g_get_monotonic_time() >= last_frame + FRAME_INTERVAL)
+        {
+            frame_needed = FALSE;
+            render();
+            last_frame = g_get_monotonic_time();
+        }
+
+        g_array_set_size(fds, 0);
+        struct pollfd pfd = { wake_fd, POLLIN, 0 };
+        g_array_append_val(fds, pfd);
+        for (guint i = 0; i < watches->len; i++)
+        {
+            pfd.fd = g_array_index(watches, watch_t, i).fd;
+            g_array_append_val(fds, pfd);
+        }
+
+        gint timeout = next_timeout();
+        struct timespec ts = { timeout / 1000, (timeout % 1000) * 1000000L };
+        gint n = ppoll((struct pollfd*) fds->data, fds->len, timeout < 0 ? NULL : &ts, &waitmask);
+        if (n < 0 && errno != EINTR)
+            fatal("poll failed: %s", g_strerror(errno));
+
+        if (n < 0 && signal_cb)
+            signal_cb(-1, signal_data);
+        if (n > 0)
+        {
+            if (g_array_index(fds, struct pollfd, 0).revents)
+                run_invocations();
+            for (guint i = 1; i < fds->len && !quit; i++)
+            {
+                struct pollfd* p = &g_array_index(fds, struct pollfd, i);
+                if (!p->revents)
+                    continue;
+                /*a handler may have removed this watch or others*/
+                for (guint j = 0; j < watches->len; j++)
+                {
+                    watch_t w = g_array_index(watches, watch_t, j);
+                    if (w.fd == p->fd)
+                    {
+                        w.cb(w.fd, w.data);
+                        break;
+                    }
+                }
+            }
+        }
+        if (!quit)
+            run_timers();
+    }
+    g_array_free(fds, TRUE);
+    sigprocmask(SIG_SETMASK, &orig, NULL);
+}
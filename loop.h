@@ -0,0 +1,19 @@
+#pragma once
+
+#include "conf.h"
+
+typedef void     (*loop_fd_cb)(gint, gpointer);
+typedef gboolean (*loop_timer_cb)(gpointer);
+typedef void     (*loop_invoke_cb)(gpointer);
+
+void     loop_add_fd(gint, loop_fd_cb, gpointer);
+void     loop_remove_fd(gint);
+void     loop_on_signal(loop_fd_cb, gpointer);
+guint    loop_add_timer(glong, loop_timer_cb, gpointer);
+guint    loop_add_idle(loop_timer_cb, gpointer);
+void     loop_remove_timer(guint);
+void     loop_invoke(loop_invoke_cb, gpointer);
+void     loop_request_frame(void);
+gboolean loop_frame_requested(void);
+void     loop_run(void (*)(void));
+void     loop_quit(void);
@@ -1,6 +1,12 @@
 #include "conf.h"
 #include "opts.h"
 #include "util.h"
+#include "fields.h"
+#include "preselect.h"
+#include "tree.h"
+#include "ansi.h"
+
+#include <string.h>
 
 static void assign_boolean(GKeyFile* key_file, gboolean* var, const gchar* key)
 {
@@ -81,6 +87,9 @@ inline static void loadconf()
         assign_boolean(key_file, &conf.initial,    "initial"   );
         assign_boolean(key_file, &conf.whitelines, "whitelines");
         assign_boolean(key_file, &conf.fullattr,   "fullattr"  );
+        assign_boolean(key_file, &conf.cache,      "cache"     );
+        assign_boolean(key_file, &conf.query,      "query"     );
+        assign_boolean(key_file, &conf.wrap,       "wrap"      );
         assign_string (key_file, &conf.foreground, "foreground");
         assign_string (key_file, &conf.background, "background");
     }
@@ -106,6 +115,9 @@ void parseopts(gint argc, gchar **argv)
         { "initial",        'i', 0,                     G_OPTION_ARG_NONE,   &conf.initial,    "check all lines initially",            NULL },
         { "whitelines",     'w', 0,                     G_OPTION_ARG_NONE,   &conf.whitelines, "do not skip white lines",              NULL },
         { "fullattr",       'l', 0,                     G_OPTION_ARG_NONE,   &conf.fullattr,   "draw attributes till the end of line", NULL },
+        { "cache",          'k', 0,                     G_OPTION_ARG_NONE,   &conf.cache,      "cache processed input files",          NULL },
+        { "query",          'q', 0,                     G_OPTION_ARG_NONE,   &conf.query,      "search with queries, not regexes",     NULL },
+        { "wrap",           0,   0,                     G_OPTION_ARG_NONE,   &conf.wrap,       "wrap long lines instead of scrolling", NULL },
         { "not-onecolumn",  'O', G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,   &conf.onecolumn,  "not --onecolumn",                      NULL },
         { "not-checkbox",   'X', G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,   &conf.checkbox,   "not --checkbox",                       NULL },
         { "not-numbers",    'N', G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,   &conf.numbers,    "not --numbers",                        NULL },
@@ -115,8 +127,42 @@ void parseopts(gint argc, gchar **argv)
         { "not-initial",    'I', G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,   &conf.initial,    "not --initial",                        NULL },
         { "not-whitelines", 'W', G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,   &conf.whitelines, "not --whitelines",                     NULL },
         { "not-fullattr",   'L', G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,   &conf.fullattr,   "not --fullattr",                       NULL },
+        { "not-cache",      'K', G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,   &conf.cache,      "not --cache",                          NULL },
+        { "not-query",      'Q', G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,   &conf.query,      "not --query",                          NULL },
+        { "not-wrap",       0,   G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,   &conf.wrap,       "not --wrap",                           NULL },
         { "foreground",     'f', 0,                     G_OPTION_ARG_STRING, &conf.foreground, "foreground color to use to highlight", NULL },
         { "background",     'b', 0,                     G_OPTION_ARG_STRING, &conf.background, "background color to use to highlight", NULL },
+        { "follow",         'F', 0,                     G_OPTION_ARG_NONE,   &conf.follow,     "keep reading input as it grows",       NULL },
+        { "stream",         's', 0,                     G_OPTION_ARG_NONE,   &conf.stream,     "write lines as soon as they are checked", NULL },
+        { "stream-unselect", 0,  0,                     G_OPTION_ARG_NONE,   &conf.stream_unselect, "sign streamed lines, report unchecks with `-'", NULL },
+        { "read0",          '0', 0,                     G_OPTION_ARG_NONE,   &conf.read0,      "input lines are terminated by NUL",    NULL },
+        { "delimiter",      'd', 0,                     G_OPTION_ARG_STRING, &conf.delimiter_str, "input line delimiter (one byte)",   "CHAR" },
+        { "print0",         'z', 0,                     G_OPTION_ARG_NONE,   &conf.print0,     "terminate output lines with NUL",      NULL },
+        { "output-delimiter", 0, 0,                     G_OPTION_ARG_STRING, &conf.output_delimiter, "terminate output lines with STR", "STR" },
+        { "print-index",    0,   0,                     G_OPTION_ARG_NONE,   &conf.print_index, "output numbers of checked lines",     NULL },
+        { "field-delimiter", 'D', 0,                    G_OPTION_ARG_STRING, &conf.field_delimiter, "fields are separated by STR, not blanks", "STR" },
+        { "nth",            0,   0,                     G_OPTION_ARG_STRING, &conf.nth,        "search only the fields in LIST",       "LIST" },
+        { "with-nth",       0,   0,                     G_OPTION_ARG_STRING, &conf.with_nth,   "show only the fields in LIST",         "LIST" },
+        { "output-fields",  0,   0,                     G_OPTION_ARG_STRING, &conf.output_fields, "output only the fields in LIST",    "LIST" },
+        { "preview",        0,   0,                     G_OPTION_ARG_STRING, &conf.preview,    "show the output of CMD for the current line", "CMD" },
+        { "preview-width",  0,   0,                     G_OPTION_ARG_INT,    &conf.preview_width, "width of the preview in percent (50)", "PERCENT" },
+        { "raw",            0,   0,                     G_OPTION_ARG_NONE,   &conf.raw,        "treat input as bytes, not text",       NULL },
+        { "exec",           'e', 0,                     G_OPTION_ARG_STRING, &conf.exec,       "run CMD for the checked lines instead of printing them", "CMD" },
+        { "exec-parallel",  'P', 0,                     G_OPTION_ARG_INT,    &conf.exec_parallel, "run N --exec jobs at once (1)",     "N" },
+        { "exec-batch",     0,   0,                     G_OPTION_ARG_INT,    &conf.exec_batch, "give each --exec job up to N lines (1)", "N" },
+        { "preselect",      0,   0,                     G_OPTION_ARG_FILENAME, &conf.preselect, "check the lines listed in FILE",       "FILE" },
+        { "preselect-regex", 0,  0,                     G_OPTION_ARG_STRING, &conf.preselect_regex, "check the lines matching RE",     "RE" },
+        { "preselect-field", 0,  0,                     G_OPTION_ARG_INT,    &conf.preselect_field, "preselect on field N only",       "N" },
+        { "preselect-normalized", 0, 0,                 G_OPTION_ARG_NONE,   &conf.preselect_normalized, "preselect on normalized text", NULL },
+        { "source",         0,   0,                     G_OPTION_ARG_STRING, &conf.source,     "read lines from CMD, R runs it again", "CMD" },
+        { "ansi",           0,   0,                     G_OPTION_ARG_NONE,   &conf.ansi,       "show the colors of the input, not its escapes", NULL },
+        { "tree",           0,   0,                     G_OPTION_ARG_NONE,   &conf.tree,       "show paths as a tree of directories",  NULL },
+        { "tree-separator", 0,   0,                     G_OPTION_ARG_STRING, &conf.tree_separator, "split --tree paths on STR (/)",    "STR" },
+        { "threads",        'j', 0,                     G_OPTION_ARG_INT,    &conf.threads,    "threads to read input with (0: one per CPU)", "N" },
+        { "tty",            0,   0,                     G_OPTION_ARG_STRING, &conf.tty,        "terminal to use instead of /dev/tty",  "PATH" },
+        { "latency-log",    0,   0,                     G_OPTION_ARG_STRING, &conf.latency_log, "log the latency of every key to FILE", "FILE" },
+        { "server",         0,   0,                     G_OPTION_ARG_STRING, &conf.server,     "keep input resident, serve it as NAME", "NAME" },
+        { "attach",         0,   0,                     G_OPTION_ARG_STRING, &conf.attach,     "choose from the resident input NAME",  "NAME" },
         { NULL,              0,  0,                     0,                   NULL,             NULL,                                   NULL },
     };
 
@@ -131,4 +177,38 @@ void parseopts(gint argc, gchar **argv)
 
     conf.execpath   = g_strdup(argv[0]);
     conf.infiles    = argv + 1;
+    if (!conf.tty)
+        conf.tty    = "/dev/tty";
+    if (conf.stream_unselect)
+        conf.stream = TRUE;
+
+    conf.delimiter = '\n';
+    if (conf.delimiter_str)
+    {
+        gchar* d = g_strcompress(conf.delimiter_str);
+        if (strlen(d) != 1)
+            fatal("delimiter must be a single byte, not `%s'", conf.delimiter_str);
+        conf.delimiter = d[0];
+        g_free(d);
+    }
+    if (conf.read0)
+        conf.delimiter = '\0';
+    if (conf.source && conf.follow)
+        fatal("--source and --follow can't be used together");
+    if (conf.exec && conf.stream)
+        fatal("--exec and --stream can't be used together");
+    if (conf.radiobox && (conf.preselect || conf.preselect_regex))
+        fatal("--radiobox can't be used with --preselect or --preselect-regex");
+    fields_init();
+    preselect_init();
+    tree_init();
+    ansi_init();
+    if (conf.preview_width <= 0 || conf.preview_width >= 100)
+        conf.preview_width = 50;
+    if (conf.output_delimiter)
+    {
+        gchar* d = g_strcompress(conf.output_delimiter);
+        g_free(conf.output_delimiter);
+        conf.output_delimiter = d;
+    }
 }
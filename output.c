@@ -0,0 +1,122 @@
+#include "output.h"
+#include "util.h"
+#include "alloc.h"
+#include "fields.h"
+
+#include <errno.h>
+
+#define WRITE_BLOCK (1 << 16)
+
+void write_all(gint fd, const gchar* buf, gsize size)
+{
+    while (size > 0)
+    {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            fatal("can't write to stdout: %s", g_strerror(errno));
+        buf  += n;
+        size -= n;
+    }
+}
+
+/* Append the output record of a line: its text, its --output-fields or its
+ * number, and the output terminator. Without --print0, --output-delimiter,
+ * --output-fields or --print-index the original bytes are kept, terminator
+ * included; terminate adds the input delimiter to a line that had none. */
+static void append_record(GString* buf, guint index, gboolean terminate)
+{
+    GString* str = get_line_t(index)->realstr;
+    gsize    len = str->len;
+    gboolean terminated = (len > 0 && str->str[len - 1] == conf.delimiter);
+
+    if (!conf.print_index && !conf.print0 && !conf.output_delimiter && !fields_output())
+    {
+        g_string_append_len(buf, str->str, len);
+        if (terminate && !terminated)
+            g_string_append_c(buf, conf.delimiter);
+        return;
+    }
+
+    if (conf.print_index)
+        g_string_append_printf(buf, "%u", index);
+    else if (fields_output())
+        fields_append_output(buf, get_line_t(index));
+    else
+    {
+        if (terminated)
+            len--;
+        if (terminated && conf.delimiter == '\n' && len > 0 && str->str[len - 1] == '\r')
+            len--;
+        g_string_append_len(buf, str->str, len);
+    }
+
+    if (conf.print0)
+        g_string_append_c(buf, '\0');
+    else if (conf.output_delimiter)
+        g_string_append(buf, conf.output_delimiter);
+    else
+        g_string_append_c(buf, '\n');
+}
+
+void write_data(void)
+{
+    gint phase = alloc_phase("output");
+    GString* buf = g_string_sized_new(WRITE_BLOCK);
+    for (guint i = 0; i < SL; i++)
+    {
+        if (!is_checked(i))
+            continue;
+        append_record(buf, i, FALSE);
+        if (buf->len >= WRITE_BLOCK)
+        {
+            write_all(STDOUT_FILENO, buf->str, buf->len);
+            g_string_truncate(buf, 0);
+        }
+    }
+    write_all(STDOUT_FILENO, buf->str, buf->len);
+    g_string_free(buf, TRUE);
+    alloc_restore(phase);
+}
+
+/*
+ * Streaming mode: selections are written to the original stdout while the
+ * session is still open. Terminal I/O goes through /dev/tty, so the two
+ * never mix. Changes are collected while a key is handled, or while a
+ * background search reports, and flushed once after it. With
+ * --stream-unselect every record is signed: `+' for a selection, `-' for
+ * an unselection.
+ */
+
+static GString* pending;
+
+void stream_line(guint index, gboolean checked)
+{
+    if (!checked && !conf.stream_unselect)
+        return;
+    if (!pending)
+        pending = g_string_new("");
+    if (conf.stream_unselect)
+        g_string_append_c(pending, checked ? '+' : '-');
+    append_record(pending, index, TRUE);
+}
+
+void stream_flush(void)
+{
+    if (!pending || pending->len == 0)
+        return;
+    gint phase = alloc_phase("output");
+    write_all(STDOUT_FILENO, pending->str, pending->len);
+    g_string_truncate(pending, 0);
+    alloc_restore(phase);
+}
+
+/* Emit lines that are checked before the session starts. */
+void stream_begin(void)
+{
+    for (guint i = 0; i < SL; i++)
+        if (is_checked(i))
+            stream_line(i, TRUE);
+    stream_flush();
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "conf.h"
+
+void write_all(gint, const gchar*, gsize);
+void write_data(void);
+void stream_line(guint, gboolean);
+void stream_flush(void);
+void stream_begin(void);
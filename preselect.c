@@ -0,0 +1,104 @@
+#include <string.h>
+
+#include "preselect.h"
+#include "fields.h"
+#include "util.h"
+
+/*
+ * Lines checked as they are read. --preselect FILE names lines, one per
+ * record, which are put in a hash set once; --preselect-regex checks the
+ * lines it matches. The text compared is the line without its
+ * terminator, or its field --preselect-field, taken from the original
+ * bytes or, with --preselect-normalized, from the normalized text.
+ */
+
+static GHashTable* wanted;
+static GRegex*     regex;
+static gint        matched;
+
+static gchar* key_of(const gchar* s, gsize len)
+{
+    if (conf.preselect_normalized && !conf.raw)
+        return g_utf8_normalize(s, len, G_NORMALIZE_ALL_COMPOSE);
+    return g_strndup(s, len);
+}
+
+void preselect_init(void)
+{
+    if (conf.preselect)
+    {
+        gchar*  data;
+        gsize   size;
+        GError* err = NULL;
+        if (!g_file_get_contents(conf.preselect, &data, &size, &err))
+            fatal("can't read `%s': %s", conf.preselect, err->message);
+        wanted = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        const gchar* end = data + size;
+        for (const gchar* p = data; p < end; )
+        {
+            const gchar* d    = memchr(p, conf.delimiter, end - p);
+            const gchar* next = d ? d + 1 : end;
+            gsize        len  = record_len(p, next - p);
+            if (len > 0)
+                g_hash_table_add(wanted, key_of(p, len));
+            p = next;
+        }
+        g_free(data);
+    }
+    if (conf.preselect_regex)
+    {
+        GError* err = NULL;
+        regex = g_regex_new(conf.preselect_regex, G_REGEX_OPTIMIZE | (conf.raw ? G_REGEX_RAW : 0), 0, &err);
+        if (!regex)
+            fatal("bad --preselect-regex: %s", err->message);
+    }
+}
+
+gboolean preselect_active(void)
+{
+    return wanted || regex;
+}
+
+/* Whether the line is preselected. Called by the reading threads. */
+gboolean preselect_line(line_t* line)
+{
+    if (!wanted && !regex)
+        return FALSE;
+    GString*     str   = conf.preselect_normalized ? line->fullstr : line->realstr;
+    const gchar* s     = str->str;
+    gsize        len   = record_len(s, str->len);
+    gsize        start = 0;
+    gsize        end   = len;
+    if (conf.preselect_field && !fields_nth(s, len, conf.preselect_field, &start, &end))
+        return FALSE;
+
+    gboolean hit = FALSE;
+    if (wanted)
+    {
+        /*short keys are looked up without an allocation*/
+        gchar  stack[256];
+        gchar* key = end - start < sizeof(stack) ? stack : g_malloc(end - start + 1);
+        memcpy(key, s + start, end - start);
+        key[end - start] = '\0';
+        hit = g_hash_table_contains(wanted, key);
+        if (key != stack)
+            g_free(key);
+    }
+    if (!hit && regex)
+        hit = g_regex_match_full(regex, s + start, end - start, 0, 0, NULL, NULL);
+    if (hit)
+        g_atomic_int_inc(&matched);
+    return hit;
+}
+
+/* Count again from n, for a new load of the lines or to go back to the
+ * count of the old ones. */
+void preselect_reset(gint n)
+{
+    g_atomic_int_set(&matched, n);
+}
+
+gint preselect_matched(void)
+{
+    return g_atomic_int_get(&matched);
+}
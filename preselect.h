@@ -0,0 +1,9 @@
+#pragma once
+
+#include "conf.h"
+
+void     preselect_init(void);
+gboolean preselect_active(void);
+gboolean preselect_line(line_t*);
+void     preselect_reset(gint);
+gint     preselect_matched(void);
@@ -0,0 +1,270 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "preview.h"
+#include "curses.h"
+#include "util.h"
+#include "loop.h"
+
+/*
+ * Preview pane, enabled with --preview CMD. The command is run by sh for
+ * the current line, with {} replaced by the quoted line, and its output is
+ * read through the event loop into a window on the right. Moving to
+ * another line kills the running command. Finished outputs are kept in an
+ * LRU cache keyed by line, so going back shows them at once.
+ */
+
+/*finished outputs kept*/
+#define PREVIEW_CACHE 128
+/*output read from one command at most*/
+#define PREVIEW_MAX   (256 * 1024)
+
+typedef struct
+{
+    line_t*  line;
+    GString* text;
+    GList*   link;
+} entry_t;
+
+static WINDOW*     pwin;
+static GHashTable* cache;
+/*most recently shown entries first*/
+static GQueue      lru = G_QUEUE_INIT;
+
+static line_t*     shown;
+static GPid        pid;
+static gint        fd = -1;
+static GString*    buf;
+/*killed commands that are still to be waited for*/
+static GArray*     dead;
+
+glong preview_cols(void)
+{
+    if (!conf.preview)
+        return 0;
+    return MAX(1, COLS * conf.preview_width / 100);
+}
+
+void preview_init(void)
+{
+    if (!conf.preview)
+        return;
+    pwin  = newwin(EL, preview_cols(), 0, COLS - preview_cols());
+    cache = g_hash_table_new(g_direct_hash, g_direct_equal);
+    dead  = g_array_new(FALSE, FALSE, sizeof(GPid));
+    buf   = g_string_new("");
+}
+
+void preview_layout(void)
+{
+    if (!pwin)
+        return;
+    wresize(pwin, EL, preview_cols());
+    mvwin(pwin, 0, COLS - preview_cols());
+}
+
+static void reap(void)
+{
+    for (guint i = 0; i < dead->len; )
+    {
+        if (waitpid(g_array_index(dead, GPid, i), NULL, WNOHANG) != 0)
+            g_array_remove_index_fast(dead, i);
+        else
+            i++;
+    }
+}
+
+/* Stop reading the running command; kill it unless it has finished. */
+static void stop(gboolean kill_it)
+{
+    if (fd < 0)
+        return;
+    loop_remove_fd(fd);
+    close(fd);
+    fd = -1;
+    if (kill_it)
+        kill(-pid, SIGTERM);
+    g_array_append_val(dead, pid);
+    reap();
+}
+
+static void remember(line_t* line, GString* text)
+{
+    if (g_queue_get_length(&lru) >= PREVIEW_CACHE)
+    {
+        entry_t* old = g_queue_pop_tail(&lru);
+        g_hash_table_remove(cache, old->line);
+        g_string_free(old->text, TRUE);
+        g_free(old);
+    }
+    entry_t* e = g_new(entry_t, 1);
+    e->line = line;
+    e->text = text;
+    g_queue_push_head(&lru, e);
+    e->link = lru.head;
+    g_hash_table_insert(cache, line, e);
+}
+
+static void on_output(gint fd, G_GNUC_UNUSED gpointer data)
+{
+    gchar   chunk[65536];
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n > 0)
+        g_string_append_len(buf, chunk, n);
+    if (n <= 0 || buf->len >= PREVIEW_MAX)
+    {
+        stop(n != 0);
+        remember(shown, buf);
+        buf = g_string_new("");
+    }
+    loop_request_frame();
+}
+
+static void child_setup(G_GNUC_UNUSED gpointer data)
+{
+    setpgid(0, 0);
+}
+
+/* Line text without its terminator, as the command gets it. */
+static gchar* line_text(line_t* line)
+{
+    return g_strndup(line->realstr->str, record_len(line->realstr->str, line->realstr->len));
+}
+
+static void run(line_t* line)
+{
+    gchar*  text   = line_text(line);
+    gchar*  quoted = g_shell_quote(text);
+    gchar** parts  = g_strsplit(conf.preview, "{}", -1);
+    gchar*  cmd    = g_strjoinv(quoted, parts);
+    gchar*  script = g_strconcat("exec 2>&1; ", cmd, NULL);
+    gchar*  argv[] = { "/bin/sh", "-c", script, NULL };
+    gint    in;
+    GError* err    = NULL;
+
+    g_string_truncate(buf, 0);
+    if (g_spawn_async_with_pipes(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, child_setup, NULL,
+                                 &pid, &in, &fd, NULL, &err))
+    {
+        close(in);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        loop_add_fd(fd, on_output, NULL);
+    }
+    else
+    {
+        fd = -1;
+        g_string_assign(buf, err->message);
+        g_error_free(err);
+    }
+    g_free(script);
+    g_free(cmd);
+    g_strfreev(parts);
+    g_free(quoted);
+    g_free(text);
+}
+
+/* Preview the given line, unless it is shown already. */
+void preview_show(glong index)
+{
+    if (!pwin || index < 0 || index >= SL)
+        return;
+    line_t* line = get_line_t(index);
+    if (line == shown)
+        return;
+    shown = line;
+    stop(TRUE);
+    entry_t* e = g_hash_table_lookup(cache, line);
+    if (e)
+    {
+        g_queue_unlink(&lru, e->link);
+        g_queue_push_head_link(&lru, e->link);
+        return;
+    }
+    run(line);
+}
+
+/* Copy of a line of output that is safe to draw: valid UTF-8, tabs
+ * expanded and other control characters dropped. */
+static gchar* sanitize(const gchar* s, gsize len)
+{
+    gchar*   valid = g_utf8_make_valid(s, len);
+    GString* out   = g_string_sized_new(len);
+    glong    col   = 0;
+    for (gchar* p = valid; *p; p = g_utf8_next_char(p))
+    {
+        gunichar c = g_utf8_get_char(p);
+        if (c == '\t')
+            do
+                g_string_append_c(out, ' ');
+            while (++col % 8);
+        else if (!g_unichar_iscntrl(c))
+        {
+            g_string_append_unichar(out, c);
+            col++;
+        }
+    }
+    g_free(valid);
+    return g_string_free(out, FALSE);
+}
+
+/* Draw the preview into its window; it is refreshed with the screen. */
+void preview_draw(void)
+{
+    if (!pwin)
+        return;
+    werase(pwin);
+    gint h = getmaxy(pwin);
+    gint w = getmaxx(pwin);
+    mvwvline(pwin, 0, 0, ACS_VLINE, h);
+
+    entry_t*  e    = g_hash_table_lookup(cache, shown);
+    GString*  text = e ? e->text : buf;
+    const gchar* p   = text->str;
+    const gchar* end = text->str + text->len;
+    for (gint y = 0; y < h && p < end; y++)
+    {
+        const gchar* nl = memchr(p, '\n', end - p);
+        if (!nl)
+            nl = end;
+        gchar* line = sanitize(p, nl - p);
+        gchar* clip = g_utf8_substring_by_width(line, 0, MIN(w - 2, g_utf8_strwidth(line)));
+        mvwaddstr(pwin, y, 2, clip);
+        g_free(clip);
+        g_free(line);
+        p = nl + 1;
+    }
+    wnoutrefresh(pwin);
+}
+
+/* Forget all previews; the lines are about to be replaced. */
+void preview_reset(void)
+{
+    if (!pwin)
+        return;
+    stop(TRUE);
+    while (!g_queue_is_empty(&lru))
+    {
+        entry_t* e = g_queue_pop_head(&lru);
+        g_string_free(e->text, TRUE);
+        g_free(e);
+    }
+    g_hash_table_remove_all(cache);
+    g_string_truncate(buf, 0);
+    shown = NULL;
+}
+
+void preview_deinit(void)
+{
+    if (!pwin)
+        return;
+    stop(TRUE);
+    delwin(pwin);
+    pwin  = NULL;
+    shown = NULL;
+}
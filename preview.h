@@ -0,0 +1,11 @@
+#pragma once
+
+#include "conf.h"
+
+void  preview_init(void);
+void  preview_deinit(void);
+glong preview_cols(void);
+void  preview_layout(void);
+void  preview_show(glong);
+void  preview_draw(void);
+void  preview_reset(void);
@@ -0,0 +1,364 @@
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "query.h"
+
+/*
+ * Search queries. A plain search is a single regex. With --query the
+ * prompt takes a small language instead:
+ *
+ *   a b      lines matching a and b
+ *   a | b    lines matching a or b; | binds tighter than a space
+ *   !a       lines not matching a
+ *   'a       a as a literal string
+ *   ^a, a$   lines starting or ending with the literal a; ^a$ is the line
+ *   a        a regex, or a literal if it has no special characters
+ *
+ * A query is compiled into a plan: an AND of clauses, each an OR of
+ * terms. Terms are ordered cheapest first within a clause, and clauses by
+ * their most expensive term, so a line is usually decided by an anchored
+ * compare or a memmem() before any regex runs. Everything is evaluated
+ * in one pass over the line, stopping as soon as the result is known.
+ */
+
+typedef enum
+{
+    TERM_EXACT,
+    TERM_PREFIX,
+    TERM_SUFFIX,
+    TERM_LITERAL,
+    TERM_REGEX,
+} term_kind_t;
+
+typedef struct
+{
+    term_kind_t kind;
+    gboolean    negate;
+    gchar*      text;
+    gsize       len;
+    GRegex*     regex;
+    gint        cost;
+} term_t;
+
+typedef struct
+{
+    GArray* terms;
+    gint    cost;
+} clause_t;
+
+struct query
+{
+    gint      ref;
+    gchar*    text;
+    gboolean  caseless;
+    GArray*   clauses;
+};
+
+static gint term_cost(const term_t* t)
+{
+    /*longer literals are cheaper per match and more selective*/
+    switch (t->kind)
+    {
+    case TERM_EXACT:
+    case TERM_PREFIX:
+    case TERM_SUFFIX:
+        return 1;
+    case TERM_LITERAL:
+        return 100 - MIN(t->len, 64);
+    default:
+        return 1000;
+    }
+}
+
+static gint by_cost(gconstpointer a, gconstpointer b)
+{
+    return ((const term_t*) a)->cost - ((const term_t*) b)->cost;
+}
+
+static gint clause_by_cost(gconstpointer a, gconstpointer b)
+{
+    return ((const clause_t*) a)->cost - ((const clause_t*) b)->cost;
+}
+
+static gboolean is_ascii(const gchar* s)
+{
+    for (; *s; s++)
+        if ((guchar) *s >= 0x80)
+            return FALSE;
+    return TRUE;
+}
+
+static gboolean compile_regex(term_t* t, const gchar* pattern, GRegexCompileFlags flags)
+{
+    t->kind  = TERM_REGEX;
+    t->regex = g_regex_new(pattern, flags | G_REGEX_OPTIMIZE, G_REGEX_MATCH_NOTEMPTY, NULL);
+    return t->regex != NULL;
+}
+
+static gboolean parse_term(term_t* t, const gchar* token, GRegexCompileFlags flags)
+{
+    memset(t, 0, sizeof(*t));
+    if (*token == '!' && token[1])
+    {
+        t->negate = TRUE;
+        token++;
+    }
+
+    gsize len = strlen(token);
+    if (*token == '\'' && len > 1)
+    {
+        t->kind = TERM_LITERAL;
+        t->text = g_strdup(token + 1);
+    }
+    else if ((*token == '^' && len > 1) || (len > 1 && token[len - 1] == '$'))
+    {
+        gboolean prefix = *token == '^';
+        gboolean suffix = len > 1 && token[len - 1] == '$';
+        t->kind = prefix && suffix ? TERM_EXACT : prefix ? TERM_PREFIX : TERM_SUFFIX;
+        t->text = g_strndup(token + prefix, len - prefix - suffix);
+    }
+    else if (strpbrk(token, ".[]()*+?{}|^$\\"))
+        return compile_regex(t, token, flags);
+    else
+    {
+        t->kind = TERM_LITERAL;
+        t->text = g_strdup(token);
+    }
+    t->len = strlen(t->text);
+
+    /*caseless literals are compared bytewise only when ASCII*/
+    if ((flags & G_REGEX_CASELESS) && !is_ascii(t->text))
+    {
+        gchar* escaped = g_regex_escape_string(t->text, -1);
+        gchar* pattern = g_strconcat(t->kind == TERM_PREFIX || t->kind == TERM_EXACT ? "^" : "", escaped,
+                                     t->kind == TERM_SUFFIX || t->kind == TERM_EXACT ? "$" : "", NULL);
+        g_free(t->text);
+        t->text = NULL;
+        gboolean ok = compile_regex(t, pattern, flags);
+        g_free(pattern);
+        g_free(escaped);
+        return ok;
+    }
+    return TRUE;
+}
+
+static void free_term(term_t* t)
+{
+    g_free(t->text);
+    if (t->regex)
+        g_regex_unref(t->regex);
+}
+
+static void free_clauses(GArray* clauses)
+{
+    for (guint i = 0; i < clauses->len; i++)
+    {
+        GArray* terms = g_array_index(clauses, clause_t, i).terms;
+        for (guint j = 0; j < terms->len; j++)
+            free_term(&g_array_index(terms, term_t, j));
+        g_array_free(terms, TRUE);
+    }
+    g_array_free(clauses, TRUE);
+}
+
+/* Compile text into a query: a single regex, or with extended a query of
+ * the language above. NULL if it is empty or a regex in it is bad. */
+query_t* query_new(const gchar* text, GRegexCompileFlags flags, gboolean extended)
+{
+    GArray*  clauses = g_array_new(FALSE, FALSE, sizeof(clause_t));
+    gboolean ok      = TRUE;
+    if (!extended)
+    {
+        term_t   t = {0};
+        clause_t c = { g_array_new(FALSE, FALSE, sizeof(term_t)), 0 };
+        ok = *text && compile_regex(&t, text, flags);
+        if (ok)
+            g_array_append_val(c.terms, t);
+        g_array_append_val(clauses, c);
+    }
+    else
+    {
+        gchar**  tokens = g_strsplit_set(text, " \t", -1);
+        gboolean join   = FALSE;
+        for (gchar** tok = tokens; *tok && ok; tok++)
+        {
+            if (**tok == '\0')
+                continue;
+            if (strcmp(*tok, "|") == 0)
+            {
+                join = clauses->len > 0;
+                continue;
+            }
+            term_t t;
+            ok = parse_term(&t, *tok, flags);
+            if (!ok)
+            {
+                free_term(&t);
+                break;
+            }
+            if (!join)
+            {
+                clause_t c = { g_array_new(FALSE, FALSE, sizeof(term_t)), 0 };
+                g_array_append_val(clauses, c);
+            }
+            join = FALSE;
+            g_array_append_val(g_array_index(clauses, clause_t, clauses->len - 1).terms, t);
+        }
+        g_strfreev(tokens);
+    }
+    if (!ok || clauses->len == 0)
+    {
+        free_clauses(clauses);
+        return NULL;
+    }
+
+    for (guint i = 0; i < clauses->len; i++)
+    {
+        clause_t* c = &g_array_index(clauses, clause_t, i);
+        for (guint j = 0; j < c->terms->len; j++)
+        {
+            term_t* t = &g_array_index(c->terms, term_t, j);
+            t->cost = term_cost(t);
+            c->cost = MAX(c->cost, t->cost);
+        }
+        g_array_sort(c->terms, by_cost);
+    }
+    g_array_sort(clauses, clause_by_cost);
+
+    query_t* q  = g_new(query_t, 1);
+    q->ref      = 1;
+    q->text     = g_strdup_printf("%c%x:%s", extended ? 'q' : 'r', flags, text);
+    q->caseless = (flags & G_REGEX_CASELESS) != 0;
+    q->clauses  = clauses;
+    return q;
+}
+
+query_t* query_ref(query_t* q)
+{
+    g_atomic_int_inc(&q->ref);
+    return q;
+}
+
+void query_unref(query_t* q)
+{
+    if (!q || !g_atomic_int_dec_and_test(&q->ref))
+        return;
+    free_clauses(q->clauses);
+    g_free(q->text);
+    g_free(q);
+}
+
+/* Identifies the query with its flags; equal texts match equally. */
+const gchar* query_text(query_t* q)
+{
+    return q->text;
+}
+
+static gboolean equal(const gchar* a, const gchar* b, gsize len, gboolean caseless)
+{
+    return caseless ? g_ascii_strncasecmp(a, b, len) == 0 : memcmp(a, b, len) == 0;
+}
+
+/* First occurrence of the literal of t in s, or NULL. */
+static const gchar* find_literal(const term_t* t, const gchar* s, gsize len, gboolean caseless)
+{
+    if (t->len > len)
+        return NULL;
+    if (!caseless)
+        return memmem(s, len, t->text, t->len);
+    if (t->len == 0)
+        return s;
+    gchar first[2] = { g_ascii_tolower(t->text[0]), g_ascii_toupper(t->text[0]) };
+    const gchar* end = s + len - t->len;
+    for (const gchar* p = s; p <= end; p++)
+        if ((*p == first[0] || *p == first[1]) && g_ascii_strncasecmp(p, t->text, t->len) == 0)
+            return p;
+    return NULL;
+}
+
+static gboolean term_hit(const term_t* t, const gchar* s, gsize len, gboolean caseless)
+{
+    switch (t->kind)
+    {
+    case TERM_EXACT:
+        return len == t->len && equal(s, t->text, len, caseless);
+    case TERM_PREFIX:
+        return len >= t->len && equal(s, t->text, t->len, caseless);
+    case TERM_SUFFIX:
+        return len >= t->len && equal(s + len - t->len, t->text, t->len, caseless);
+    case TERM_LITERAL:
+        return find_literal(t, s, len, caseless) != NULL;
+    default:
+        return g_regex_match_full(t->regex, s, len, 0, G_REGEX_MATCH_NOTEMPTY, NULL, NULL);
+    }
+}
+
+/* Whether the query matches the given spans of s. A term holds if it hits
+ * in any span, a negated one if it hits in none. */
+gboolean query_match(query_t* q, const gchar* s, const query_span_t* spans, guint n)
+{
+    for (guint i = 0; i < q->clauses->len; i++)
+    {
+        GArray*  terms = g_array_index(q->clauses, clause_t, i).terms;
+        gboolean any   = FALSE;
+        for (guint j = 0; j < terms->len && !any; j++)
+        {
+            const term_t* t   = &g_array_index(terms, term_t, j);
+            gboolean      hit = FALSE;
+            for (guint k = 0; k < n && !hit; k++)
+                hit = term_hit(t, s + spans[k].start, spans[k].end - spans[k].start, q->caseless);
+            any = hit != t->negate;
+        }
+        if (!any)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* Report every hit of a term that is not negated, for highlighting. */
+void query_hits(query_t* q, const gchar* s, gsize len, query_hit_cb cb, gpointer data)
+{
+    for (guint i = 0; i < q->clauses->len; i++)
+    {
+        GArray* terms = g_array_index(q->clauses, clause_t, i).terms;
+        for (guint j = 0; j < terms->len; j++)
+        {
+            const term_t* t = &g_array_index(terms, term_t, j);
+            if (t->negate)
+                continue;
+            switch (t->kind)
+            {
+            case TERM_EXACT:
+            case TERM_PREFIX:
+            case TERM_SUFFIX:
+                if (term_hit(t, s, len, q->caseless))
+                    cb(t->kind == TERM_SUFFIX ? len - t->len : 0, t->kind == TERM_PREFIX ? t->len : len, data);
+                break;
+            case TERM_LITERAL:
+            {
+                const gchar* p = s;
+                const gchar* hit;
+                while (t->len > 0 && (hit = find_literal(t, p, s + len - p, q->caseless)))
+                {
+                    cb(hit - s, hit - s + t->len, data);
+                    p = hit + t->len;
+                }
+                break;
+            }
+            default:
+            {
+                GMatchInfo* info;
+                g_regex_match_full(t->regex, s, len, 0, G_REGEX_MATCH_NOTEMPTY, &info, NULL);
+                while (g_match_info_matches(info))
+                {
+                    gint ms, me;
+                    if (g_match_info_fetch_pos(info, 0, &ms, &me))
+                        cb(ms, me, data);
+                    g_match_info_next(info, NULL);
+                }
+                g_match_info_free(info);
+            }
+            }
+        }
+    }
+}
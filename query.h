@@ -0,0 +1,21 @@
+#pragma once
+
+#include <glib.h>
+
+typedef struct query query_t;
+
+/*a part of a line a query looks into, in bytes*/
+typedef struct
+{
+    gsize start;
+    gsize end;
+} query_span_t;
+
+typedef void (*query_hit_cb)(gsize, gsize, gpointer);
+
+query_t*     query_new(const gchar*, GRegexCompileFlags, gboolean);
+query_t*     query_ref(query_t*);
+void         query_unref(query_t*);
+const gchar* query_text(query_t*);
+gboolean     query_match(query_t*, const gchar*, const query_span_t*, guint);
+void         query_hits(query_t*, const gchar*, gsize, query_hit_cb, gpointer);
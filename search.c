@@ -0,0 +1,252 @@
+#include "search.h"
+#include "util.h"
+#include "loop.h"
+#include "alloc.h"
+#include "fields.h"
+#include "output.h"
+
+/*
+ * Background search. A worker thread matches a snapshot of the lines in
+ * chunks and reports every chunk to the main thread through the event
+ * loop, where on_match() is called for each matching line. A scan with
+ * direction 0 covers all lines in order and remembers what it found;
+ * with direction 1 or -1 it starts next to a line, goes that way around,
+ * and stops at the first match.
+ *
+ * Starting a search or search_cancel() bumps the generation; the worker
+ * notices at the next chunk and reports from older generations are
+ * dropped.
+ */
+
+typedef struct
+{
+    gint     generation;
+    query_t* query;
+    line_t** lines;
+    glong    n;
+    glong    from;
+    gint     direction;
+} job_t;
+
+typedef struct
+{
+    gint     generation;
+    GArray*  matches;
+    glong    done;
+    gboolean last;
+} report_t;
+
+static gint            generation;
+static gboolean        running;
+static gboolean        complete;
+static glong           done;
+static glong           total;
+static glong           count;
+static GArray*         found;
+static query_t*        found_query;
+static search_match_cb on_match;
+
+/*workers still running, older generations included*/
+static gint            workers;
+static GMutex          workers_lock;
+static GCond           workers_done;
+
+/*the last search, for search_restart()*/
+static query_t*        last_query;
+static gint            last_direction;
+static glong           last_from;
+
+static void on_report(gpointer data)
+{
+    report_t* r = data;
+    if (r->generation == g_atomic_int_get(&generation))
+    {
+        glong percent = total ? 100 * done / total : 100;
+        done   = r->done;
+        count += r->matches->len;
+        if (found)
+            g_array_append_vals(found, r->matches->data, r->matches->len);
+        for (guint i = 0; i < r->matches->len; i++)
+            on_match(g_array_index(r->matches, glong, i));
+        /*m, M and T (un)check lines as they are found*/
+        if (conf.stream && r->matches->len > 0)
+            stream_flush();
+        if (r->last)
+        {
+            running  = FALSE;
+            complete = TRUE;
+        }
+        if (r->last || r->matches->len > 0 || (total && 100 * done / total != percent))
+            loop_request_frame();
+    }
+    g_array_free(r->matches, TRUE);
+    g_free(r);
+}
+
+static void report(job_t* job, GArray* matches, glong done_lines, gboolean last)
+{
+    report_t* r = g_new(report_t, 1);
+    r->generation = job->generation;
+    r->matches    = matches;
+    r->done       = done_lines;
+    r->last       = last;
+    loop_invoke(on_report, r);
+}
+
+static gpointer worker(gpointer data)
+{
+    job_t*  job     = data;
+    glong   k       = 0;
+    gboolean stop   = FALSE;
+    alloc_phase("search");
+    while (k < job->n && !stop)
+    {
+        if (g_atomic_int_get(&generation) != job->generation)
+            break;
+        GArray* matches = g_array_new(FALSE, FALSE, sizeof(glong));
+        glong end = MIN(job->n, k + SEARCH_CHUNK);
+        for (; k < end; k++)
+        {
+            glong i = k;
+            if (job->direction)
+                i = ((job->from + job->direction * (k + 1)) % job->n + job->n) % job->n;
+            if (fields_match(job->query, job->lines[i]))
+            {
+                g_array_append_val(matches, i);
+                if (job->direction)
+                {
+                    stop = TRUE;
+                    break;
+                }
+            }
+        }
+        report(job, matches, k, stop || k == job->n);
+    }
+    if (job->n == 0)
+        report(job, g_array_new(FALSE, FALSE, sizeof(glong)), 0, TRUE);
+    query_unref(job->query);
+    g_free(job->lines);
+    g_free(job);
+
+    g_mutex_lock(&workers_lock);
+    workers--;
+    g_cond_signal(&workers_done);
+    g_mutex_unlock(&workers_lock);
+    return NULL;
+}
+
+/* Search lines with query in the background, see above. */
+void search_run(query_t* query, gint direction, glong from, search_match_cb cb)
+{
+    search_cancel();
+    job_t* job = g_new(job_t, 1);
+    job->generation = g_atomic_int_get(&generation);
+    job->query      = query_ref(query);
+    job->n          = SL;
+    job->from       = from;
+    job->direction  = direction;
+    /*lines are never changed once read, but strings may grow meanwhile*/
+    job->lines      = g_new(line_t*, MAX(1, job->n));
+    for (glong i = 0; i < job->n; i++)
+        job->lines[i] = get_line_t(i);
+
+    on_match = cb;
+    running  = TRUE;
+    complete = FALSE;
+    done     = 0;
+    total    = job->n;
+    count    = 0;
+    if (found)
+        g_array_free(found, TRUE);
+    query_unref(found_query);
+    found       = direction ? NULL : g_array_new(FALSE, FALSE, sizeof(glong));
+    found_query = direction ? NULL : query_ref(query);
+
+    query_unref(last_query);
+    last_query     = query_ref(query);
+    last_direction = direction;
+    last_from      = from;
+
+    g_mutex_lock(&workers_lock);
+    workers++;
+    g_mutex_unlock(&workers_lock);
+    g_thread_unref(g_thread_new("search", worker, job));
+}
+
+/* Cancel the search, wait until no worker looks at the lines any more and
+ * forget what was found; the lines are about to be replaced. Returns
+ * whether a search was running. */
+gboolean search_quiesce(void)
+{
+    gboolean was_running = running;
+    search_cancel();
+    g_mutex_lock(&workers_lock);
+    while (workers > 0)
+        g_cond_wait(&workers_done, &workers_lock);
+    g_mutex_unlock(&workers_lock);
+
+    if (found)
+        g_array_free(found, TRUE);
+    found    = NULL;
+    query_unref(found_query);
+    found_query = NULL;
+    complete = FALSE;
+    return was_running;
+}
+
+/* Run the last search again, over the current lines. */
+void search_restart(void)
+{
+    if (last_query)
+        search_run(last_query, last_direction, MIN(last_from, (glong) SL - 1), on_match);
+}
+
+void search_cancel(void)
+{
+    g_atomic_int_inc(&generation);
+    if (running)
+        loop_request_frame();
+    running = FALSE;
+}
+
+gboolean search_running(void)
+{
+    return running;
+}
+
+/* Progress for the status line, NULL when idle. */
+gchar* search_status(void)
+{
+    if (!running)
+        return NULL;
+    glong percent = total ? 100 * done / total : 100;
+    return g_strdup_printf("[%ld%% %ld found] ", percent, count);
+}
+
+/* Nearest line a full scan with query has found so far after (or before,
+ * for direction -1) the given one, wrapping around. Returns -1 if that is
+ * unknown, -2 if a finished scan of all current lines found nothing. */
+glong search_found_after(query_t* query, glong from, gint direction)
+{
+    if (!found || query != found_query || !(running || (complete && total == SL)))
+        return -1;
+    if (found->len == 0)
+        return running ? -1 : -2;
+    guint lo = 0;
+    guint hi = found->len;
+    while (lo < hi)
+    {
+        guint mid = (lo + hi) / 2;
+        if (g_array_index(found, glong, mid) <= from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    /*lo is the first match after from*/
+    if (direction > 0)
+        return g_array_index(found, glong, lo < found->len ? lo : 0);
+    guint before = lo;
+    if (before > 0 && g_array_index(found, glong, before - 1) == from)
+        before--;
+    return g_array_index(found, glong, before > 0 ? before - 1 : found->len - 1);
+}
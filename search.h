@@ -0,0 +1,17 @@
+#pragma once
+
+#include "conf.h"
+#include "query.h"
+
+/*lines matched by the worker between two reports to the main thread*/
+#define SEARCH_CHUNK 4096
+
+typedef void (*search_match_cb)(glong);
+
+void     search_run(query_t*, gint, glong, search_match_cb);
+void     search_cancel(void);
+gboolean search_running(void);
+gchar*   search_status(void);
+glong    search_found_after(query_t*, glong, gint);
+gboolean search_quiesce(void);
+void     search_restart(void);
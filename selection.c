@@ -0,0 +1,189 @@
+#include <string.h>
+
+#include "selection.h"
+#include "util.h"
+
+/*
+ * The checked lines as a bitmap, for the checked-only view. Popcounts
+ * of blocks of BLOCK_BITS lines are summed in a Fenwick tree, so the
+ * number of checked lines before a line (rank) and the line of the k-th
+ * checked one (select) take O(log N), and so does (un)checking a line.
+ * The bitmap exists only while the view is on; set_checked() keeps it
+ * up to date.
+ */
+
+#define BLOCK_WORDS 8
+#define BLOCK_BITS  (64 * BLOCK_WORDS)
+
+static guint64* bits;
+/*tree[b] sums the popcounts of blocks (b - lowbit(b), b], 1-based*/
+static glong*   tree;
+static glong    n;
+static glong    blocks;
+static glong    capacity;
+static glong    count;
+static gboolean changed;
+
+#define lowbit(i) ((i) & -(i))
+
+static void add(glong block, glong delta)
+{
+    for (glong i = block + 1; i <= blocks; i += lowbit(i))
+        tree[i] += delta;
+}
+
+/*checked lines in the blocks before block*/
+static glong prefix(glong block)
+{
+    glong sum = 0;
+    for (glong i = block; i > 0; i -= lowbit(i))
+        sum += tree[i];
+    return sum;
+}
+
+static void reserve(glong size)
+{
+    if (size < capacity)
+        return;
+    glong old = capacity;
+    capacity  = MAX(size + 1, capacity * 2);
+    bits = g_renew(guint64, bits, capacity * BLOCK_WORDS);
+    tree = g_renew(glong, tree, capacity + 1);
+    memset(bits + old * BLOCK_WORDS, 0, (capacity - old) * BLOCK_WORDS * sizeof(guint64));
+}
+
+/* Index the checked lines of strings, from scratch. */
+void selection_build(void)
+{
+    selection_free();
+    n      = SL;
+    blocks = (n + BLOCK_BITS - 1) / BLOCK_BITS;
+    reserve(blocks);
+    for (glong i = 0; i < n; i++)
+        if (is_checked(i))
+            bits[i / 64] |= G_GUINT64_CONSTANT(1) << (i % 64);
+    tree[0] = 0;
+    for (glong b = 0; b < blocks; b++)
+    {
+        glong c = 0;
+        for (glong w = 0; w < BLOCK_WORDS; w++)
+            c += __builtin_popcountll(bits[b * BLOCK_WORDS + w]);
+        tree[b + 1] = c;
+        count      += c;
+    }
+    for (glong i = 1; i <= blocks; i++)
+        if (i + lowbit(i) <= blocks)
+            tree[i + lowbit(i)] += tree[i];
+}
+
+void selection_free(void)
+{
+    g_free(bits);
+    g_free(tree);
+    bits     = NULL;
+    tree     = NULL;
+    n        = 0;
+    blocks   = 0;
+    capacity = 0;
+    count    = 0;
+}
+
+/* Index the lines appended since the last call. */
+void selection_sync(void)
+{
+    if (!bits)
+        return;
+    glong want = (SL + BLOCK_BITS - 1) / BLOCK_BITS;
+    reserve(want);
+    /*new, empty blocks: a node sums its children i - 1, i - 2, i - 4, ...*/
+    for (glong i = blocks + 1; i <= want; i++)
+    {
+        tree[i] = 0;
+        for (glong k = 1; k < lowbit(i); k <<= 1)
+            tree[i] += tree[i - k];
+        blocks = i;
+    }
+    glong first = n;
+    n = SL;
+    for (glong i = first; i < n; i++)
+        if (is_checked(i))
+        {
+            bits[i / 64] |= G_GUINT64_CONSTANT(1) << (i % 64);
+            add(i / BLOCK_BITS, 1);
+            count++;
+            changed = TRUE;
+        }
+}
+
+void selection_set(guint index, gboolean b)
+{
+    if (!bits || index >= n)
+        return;
+    guint64  mask = G_GUINT64_CONSTANT(1) << (index % 64);
+    gboolean was  = (bits[index / 64] & mask) != 0;
+    if (!was == !b)
+        return;
+    bits[index / 64] ^= mask;
+    add(index / BLOCK_BITS, b ? 1 : -1);
+    count  += b ? 1 : -1;
+    changed = TRUE;
+}
+
+glong selection_count(void)
+{
+    return count;
+}
+
+/* Checked lines before the line. */
+glong selection_rank(glong line)
+{
+    line = MIN(MAX(line, 0), n);
+    glong block = line / BLOCK_BITS;
+    glong rank  = prefix(block);
+    glong w     = block * BLOCK_WORDS;
+    for (; w < line / 64; w++)
+        rank += __builtin_popcountll(bits[w]);
+    if (line % 64)
+        rank += __builtin_popcountll(bits[w] & ((G_GUINT64_CONSTANT(1) << (line % 64)) - 1));
+    return rank;
+}
+
+/* The line of the k-th checked line, counting from 0. */
+glong selection_select(glong k)
+{
+    if (count == 0)
+        return 0;
+    k = MIN(MAX(k, 0), count - 1);
+    glong block = 0;
+    glong step  = 1;
+    while (step <= blocks / 2)
+        step <<= 1;
+    for (; step > 0; step >>= 1)
+    {
+        if (block + step <= blocks && tree[block + step] <= k)
+        {
+            block += step;
+            k     -= tree[block];
+        }
+    }
+    for (glong w = block * BLOCK_WORDS; ; w++)
+    {
+        guint64 word = bits[w];
+        glong   c    = __builtin_popcountll(word);
+        if (k < c)
+        {
+            while (k-- > 0)
+                word &= word - 1;
+            return w * 64 + __builtin_ctzll(word);
+        }
+        k -= c;
+    }
+}
+
+/* Whether the selection changed since the last call. */
+gboolean selection_changed(void)
+{
+    gboolean was = changed;
+    changed = FALSE;
+    return was;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "conf.h"
+
+void     selection_build(void);
+void     selection_free(void);
+void     selection_sync(void);
+void     selection_set(guint, gboolean);
+glong    selection_count(void);
+glong    selection_rank(glong);
+glong    selection_select(glong);
+gboolean selection_changed(void);
@@ -0,0 +1,256 @@
+#include "server.h"
+#include "util.h"
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * Resident mode. The server reads its input once and then waits on a unix
+ * socket. An attaching client passes its terminal and its stdout over the
+ * socket; the server forks, and the child runs an ordinary session on those
+ * descriptors with a copy-on-write view of the already processed lines.
+ * The client only relays signals and waits for the exit status.
+ *
+ * Once it listens, the server leaves the shell that started it: it forks,
+ * the parent returns, and the child goes on in a session of its own, so
+ * it shares no terminal with that shell.
+ */
+
+typedef struct
+{
+    gchar term[64];
+} hello_t;
+
+static gchar socket_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+static void make_address(const gchar* name, struct sockaddr_un* addr)
+{
+    if (!*name || strchr(name, '/'))
+        fatal("bad session name `%s'", name);
+    gchar* path = g_strdup_printf("%s/%s-%s.sock", g_get_user_runtime_dir(), APPNAME, name);
+    if (strlen(path) >= sizeof(addr->sun_path))
+        fatal("socket path `%s' is too long", path);
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    g_free(path);
+}
+
+static void on_server_signal(gint sig)
+{
+    unlink(socket_path);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/* Receive the hello message together with the client's tty and stdout. */
+static gboolean receive_client(gint sock, hello_t* hello, gint* tty, gint* out)
+{
+    struct iovec  iov = { hello, sizeof(*hello) };
+    union
+    {
+        gchar          buf[CMSG_SPACE(2 * sizeof(gint))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {0};
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    if (recvmsg(sock, &msg, 0) != sizeof(*hello))
+        return FALSE;
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(2 * sizeof(gint)))
+        return FALSE;
+    gint fds[2];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    *tty = fds[0];
+    *out = fds[1];
+    hello->term[sizeof(hello->term) - 1] = '\0';
+    return TRUE;
+}
+
+static void run_client(gint sock, const hello_t* hello, gint tty, gint out, gint (*session)(void))
+{
+    signal(SIGINT,  SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGHUP,  SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    if (*hello->term)
+        setenv("TERM", hello->term, TRUE);
+
+    dup2(out, STDOUT_FILENO);
+    dup2(tty, STDIN_FILENO);
+    close(out);
+    close(tty);
+    conf.tty = "/dev/stdin";
+
+    pid_t pid = getpid();
+    if (write(sock, &pid, sizeof(pid)) != sizeof(pid))
+        _exit(EXIT_FAILURE);
+
+    guchar status = session();
+    if (write(sock, &status, sizeof(status)) != sizeof(status))
+        _exit(EXIT_FAILURE);
+    _exit(EXIT_SUCCESS);
+}
+
+void serve(const gchar* name, gint (*session)(void))
+{
+    struct sockaddr_un addr;
+    make_address(name, &addr);
+    g_strlcpy(socket_path, addr.sun_path, sizeof(socket_path));
+
+    gint listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+        fatal("can't create socket: %s", g_strerror(errno));
+    /*a socket left by a dead server refuses connections, a live one not*/
+    if (connect(listener, (struct sockaddr*)&addr, sizeof(addr)) == 0)
+        fatal("`%s' is already served", name);
+    if (errno == ECONNREFUSED)
+        unlink(socket_path);
+    close(listener);
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+        fatal("can't create socket: %s", g_strerror(errno));
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        fatal("can't bind `%s': %s", socket_path, g_strerror(errno));
+    chmod(socket_path, S_IRUSR | S_IWUSR);
+    if (listen(listener, 16) < 0)
+        fatal("can't listen on `%s': %s", socket_path, g_strerror(errno));
+
+    pid_t server = fork();
+    if (server < 0)
+        fatal("can't fork: %s", g_strerror(errno));
+    if (server > 0)
+        exit(EXIT_SUCCESS);
+    setsid();
+    gint devnull = open("/dev/null", O_RDWR);
+    if (devnull >= 0)
+    {
+        dup2(devnull, STDIN_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        close(devnull);
+    }
+
+    signal(SIGINT,  on_server_signal);
+    signal(SIGTERM, on_server_signal);
+    signal(SIGHUP,  on_server_signal);
+    /*sessions are never waited for*/
+    signal(SIGCHLD, SIG_IGN);
+
+    while (TRUE)
+    {
+        gint sock = accept(listener, NULL, NULL);
+        if (sock < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fatal("can't accept on `%s': %s", socket_path, g_strerror(errno));
+        }
+        fcntl(sock, F_SETFD, FD_CLOEXEC);
+        hello_t hello;
+        gint    tty, out;
+        if (!receive_client(sock, &hello, &tty, &out))
+        {
+            warn("bad client on `%s'", socket_path);
+            close(sock);
+            continue;
+        }
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(listener);
+            run_client(sock, &hello, tty, out, session);
+        }
+        if (pid < 0)
+            warn("can't fork: %s", g_strerror(errno));
+        close(tty);
+        close(out);
+        close(sock);
+    }
+}
+
+static pid_t session_pid;
+
+static void on_client_signal(gint sig)
+{
+    if (session_pid > 0)
+        kill(session_pid, sig);
+}
+
+static gboolean read_full(gint fd, gpointer buf, gsize size)
+{
+    gsize done = 0;
+    while (done < size)
+    {
+        ssize_t n = read(fd, (gchar*)buf + done, size - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        done += n;
+    }
+    return TRUE;
+}
+
+gint attach(const gchar* name)
+{
+    struct sockaddr_un addr;
+    make_address(name, &addr);
+
+    gint tty = open("/dev/tty", O_RDWR | O_CLOEXEC);
+    if (tty < 0)
+        fatal("can't open /dev/tty");
+    gint sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        fatal("can't connect to `%s': %s", addr.sun_path, g_strerror(errno));
+
+    hello_t hello = {0};
+    const gchar* term = g_getenv("TERM");
+    if (term)
+        g_strlcpy(hello.term, term, sizeof(hello.term));
+
+    gint fds[2] = { tty, STDOUT_FILENO };
+    struct iovec iov = { &hello, sizeof(hello) };
+    union
+    {
+        gchar          buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg = {0};
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(sock, &msg, 0) != sizeof(hello))
+        fatal("can't send to `%s': %s", addr.sun_path, g_strerror(errno));
+    close(tty);
+
+    if (!read_full(sock, &session_pid, sizeof(session_pid)))
+        fatal("session on `%s' failed to start", addr.sun_path);
+
+    /*the terminal delivers its signals to us, not to the session*/
+    struct sigaction sa = {0};
+    sa.sa_handler = on_client_signal;
+    sigaction(SIGWINCH, &sa, NULL);
+    sigaction(SIGINT,   &sa, NULL);
+    sigaction(SIGTERM,  &sa, NULL);
+    sigaction(SIGHUP,   &sa, NULL);
+
+    guchar status;
+    if (!read_full(sock, &status, sizeof(status)))
+        return EXIT_FAILURE;
+    close(sock);
+    return status;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "conf.h"
+
+void  serve(const gchar*, gint (*)(void));
+gint  attach(const gchar*);
@@ -0,0 +1,246 @@
+#include <errno.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "source.h"
+#include "input.h"
+#include "util.h"
+#include "loop.h"
+#include "search.h"
+#include "preview.h"
+#include "highlight.h"
+#include "preselect.h"
+#include "output.h"
+
+/*
+ * --source CMD: lines are read from the output of CMD run by sh, and
+ * reloading runs it again. A reload reads into a new list in a thread
+ * while the old one stays in use. The thread then matches new lines to
+ * old ones by content. A hash table maps each old line's text to its
+ * first unmatched occurrence, and duplicates are chained in order, so
+ * the k-th copy of a line matches the k-th copy. Everything is swapped
+ * in on the main thread: checked states carry over, the current line
+ * follows its text, and the old lines are freed.
+ */
+
+typedef struct
+{
+    line_t**       old;
+    guint          n_old;
+    glong          current;
+    GPtrArray*     lines;
+    guint          widest;
+    /*old index of each new line, -1 for new text*/
+    glong*         origin;
+    glong          new_current;
+    gint           preselected;
+    /*why the reload failed, or NULL*/
+    gchar*         error;
+    source_done_cb done;
+} reload_t;
+
+static gboolean reloading;
+/*why the last reload kept the old lines, or NULL*/
+static gchar*   problem;
+
+/* Start --source; returns the descriptor of its output, or -1 with
+ * *error set. */
+static gint spawn(GPid* pid, GSpawnFlags flags, gchar** error)
+{
+    gchar*  argv[] = { "/bin/sh", "-c", conf.source, NULL };
+    gint    in, out;
+    GError* err    = NULL;
+    if (!g_spawn_async_with_pipes(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD | flags, NULL, NULL,
+                                  pid, &in, &out, NULL, &err))
+    {
+        *error = g_strdup_printf("can't run `%s': %s", conf.source, err->message);
+        g_error_free(err);
+        return -1;
+    }
+    close(in);
+    return out;
+}
+
+/* Reap --source; returns why it failed, or NULL. */
+static gchar* wait_for(GPid pid)
+{
+    gint status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    g_spawn_close_pid(pid);
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+        return g_strdup_printf("`%s' exited with %d", conf.source, WEXITSTATUS(status));
+    if (!WIFEXITED(status))
+        return g_strdup_printf("`%s' failed", conf.source);
+    return NULL;
+}
+
+/* Read the lines of --source before the session. */
+void source_read(void)
+{
+    GPid   pid;
+    gchar* error = NULL;
+    gint   fd    = spawn(&pid, 0, &error);
+    if (fd < 0)
+        fatal("%s", error);
+    read_input(fd, conf.source);
+    error = wait_for(pid);
+    if (error)
+        warn("%s", error);
+    g_free(error);
+}
+
+static void reconcile(reload_t* r)
+{
+    GHashTable* first = g_hash_table_new((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal);
+    glong*      next  = g_new(glong, MAX(1, r->n_old));
+    for (glong i = (glong) r->n_old - 1; i >= 0; i--)
+    {
+        GString* key  = r->old[i]->realstr;
+        gpointer head = g_hash_table_lookup(first, key);
+        next[i] = head ? (glong) GPOINTER_TO_SIZE(head) - 1 : -1;
+        g_hash_table_insert(first, key, GSIZE_TO_POINTER(i + 1));
+    }
+
+    r->origin      = g_new(glong, MAX(1, r->lines->len));
+    r->new_current = -1;
+    glong nearest  = -1;
+    for (guint j = 0; j < r->lines->len; j++)
+    {
+        GString* key  = ((line_t*) g_ptr_array_index(r->lines, j))->realstr;
+        gpointer head = g_hash_table_lookup(first, key);
+        glong    i    = head ? (glong) GPOINTER_TO_SIZE(head) - 1 : -1;
+        r->origin[j] = i;
+        if (i < 0)
+            continue;
+        if (next[i] >= 0)
+            g_hash_table_insert(first, key, GSIZE_TO_POINTER(next[i] + 1));
+        else
+            g_hash_table_remove(first, key);
+        /*the current line, or the first survivor after it*/
+        if (i >= r->current && (nearest < 0 || i < nearest))
+        {
+            nearest        = i;
+            r->new_current = j;
+        }
+    }
+    if (r->new_current < 0)
+        r->new_current = MIN(r->current, (glong) r->lines->len - 1);
+    g_free(next);
+    g_hash_table_destroy(first);
+}
+
+static void free_reload(reload_t* r)
+{
+    g_free(r->origin);
+    g_free(r->old);
+    g_free(r);
+}
+
+static void swap(gpointer data)
+{
+    reload_t* r = data;
+    reloading   = FALSE;
+    g_free(problem);
+    problem = r->error;
+    if (!problem && r->lines->len == 0)
+        problem = g_strdup("printed nothing");
+    if (problem)
+    {
+        /*keep the old lines: a failed command's are not to be trusted,
+         *and a session needs some*/
+        for (guint j = 0; j < r->lines->len; j++)
+            free_line(g_ptr_array_index(r->lines, j));
+        g_ptr_array_free(r->lines, TRUE);
+        preselect_reset(r->preselected);
+        free_reload(r);
+        loop_request_frame();
+        return;
+    }
+
+    gboolean searching = search_quiesce();
+    preview_reset();
+    highlight_reset();
+
+    /*a line that carries over keeps its state, so --stream only hears of
+     *checked lines that are gone and new lines that come checked*/
+    gboolean* kept = g_new0(gboolean, MAX(1, r->n_old));
+    for (guint j = 0; j < r->lines->len; j++)
+        if (r->origin[j] >= 0)
+        {
+            ((line_t*) g_ptr_array_index(r->lines, j))->checked = r->old[r->origin[j]]->checked;
+            kept[r->origin[j]] = TRUE;
+        }
+    if (conf.stream)
+        for (guint i = 0; i < r->n_old; i++)
+            if (!kept[i] && is_checked(i))
+                stream_line(i, FALSE);
+    g_free(kept);
+
+    GPtrArray* old = strings;
+    strings          = r->lines;
+    max_string_width = r->widest;
+    for (guint i = 0; i < old->len; i++)
+        free_line(g_ptr_array_index(old, i));
+    g_ptr_array_free(old, TRUE);
+
+    if (conf.stream)
+    {
+        for (guint j = 0; j < SL; j++)
+            if (r->origin[j] < 0 && is_checked(j))
+                stream_line(j, TRUE);
+        stream_flush();
+    }
+
+    r->done(MAX(0, r->new_current), searching);
+    free_reload(r);
+}
+
+static gpointer reloader(gpointer data)
+{
+    reload_t* r = data;
+    GPid      pid;
+    /*stderr would write over the screen; errors go to the status line*/
+    gint fd = spawn(&pid, G_SPAWN_STDERR_TO_DEV_NULL, &r->error);
+    if (fd >= 0)
+    {
+        read_input_into(fd, conf.source, r->lines, &r->widest, &r->error);
+        gchar* failed = wait_for(pid);
+        if (r->error)
+            g_free(failed);
+        else
+            r->error = failed;
+    }
+    if (!r->error)
+        reconcile(r);
+    loop_invoke(swap, r);
+    return NULL;
+}
+
+/* Run --source again in the background; done is called with the line
+ * that replaces the current one once the new lines are in place. */
+void source_reload(glong current, source_done_cb done)
+{
+    if (!conf.source || reloading)
+        return;
+    reloading = TRUE;
+    reload_t* r = g_new0(reload_t, 1);
+    r->n_old       = SL;
+    r->old         = g_memdup2(strings->pdata, MAX(1, SL) * sizeof(line_t*));
+    r->current     = current;
+    r->lines       = g_ptr_array_new();
+    r->preselected = preselect_matched();
+    r->done        = done;
+    preselect_reset(0);
+    g_thread_unref(g_thread_new("reload", reloader, r));
+}
+
+gboolean source_reloading(void)
+{
+    return reloading;
+}
+
+/* Why the last reload kept the old lines, or NULL. */
+const gchar* source_problem(void)
+{
+    return problem;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "conf.h"
+
+typedef void (*source_done_cb)(glong, gboolean);
+
+void         source_read(void);
+void         source_reload(glong, source_done_cb);
+gboolean     source_reloading(void);
+const gchar* source_problem(void);
@@ -0,0 +1,306 @@
+#include <string.h>
+
+#include "tree.h"
+#include "util.h"
+
+/*
+ * --tree shows the lines as a tree of paths split on --tree-separator.
+ * The tree is built once, in one pass over the lines: a path that goes
+ * on from the path of the line before it shares that line's nodes, any
+ * other starts new ones. So input grouped by directory, like the output
+ * of find or git ls-files, gives each directory one node, and the lines
+ * under any node are the contiguous range [first, last). Ungrouped input
+ * still works, a directory just shows up once per run of its lines.
+ *
+ * Nodes are kept in preorder with the index of the node after their
+ * subtree, so a subtree is skipped in O(1). The rows shown are the
+ * nodes whose ancestors are all expanded, in a sorted array of node
+ * indexes that expanding and collapsing splice.
+ *
+ * The lines under a node are those of the node and its ancestors, so
+ * each node counts its checked lines, and checking a line updates the
+ * count of its node and the nodes above it.
+ */
+
+#define NONE G_MAXUINT32
+
+typedef struct
+{
+    guint32 first;  /*lines under the node are [first, last)*/
+    guint32 last;
+    guint32 checked; /*how many of them are checked*/
+    guint32 next;   /*node after the subtree*/
+    guint32 parent;
+    guint32 line;   /*line of the node's own path, or NONE*/
+    guint32 name;   /*name: bytes [name, name + len) of line first*/
+    guint32 len;
+    guint16 depth;
+    guint8  open;
+} node_t;
+
+static GArray*  nodes;
+static guint32* node_of;
+static GArray*  shown;
+/*a range is being set; its counts are fixed once at the end*/
+static gboolean range_setting;
+
+#define NODE(i) (&g_array_index(nodes, node_t, (i)))
+#define SHOWN(p) g_array_index(shown, guint32, (p))
+
+void tree_init(void)
+{
+    if (!conf.tree)
+        return;
+    if (!conf.tree_separator)
+        conf.tree_separator = "/";
+    if (!*conf.tree_separator)
+        fatal("--tree-separator can't be empty");
+    if (conf.raw)
+        fatal("--tree and --raw can't be used together");
+    if (conf.follow)
+        fatal("--tree and --follow can't be used together");
+}
+
+static inline const gchar* name_of(node_t* node)
+{
+    return get_str(node->first) + node->name;
+}
+
+static inline gboolean has_children(guint32 v)
+{
+    return NODE(v)->next > v + 1;
+}
+
+static void close_from(GArray* stack, guint depth, guint32 line)
+{
+    for (guint d = depth; d < stack->len; d++)
+    {
+        node_t* node = NODE(g_array_index(stack, guint32, d));
+        node->last = line;
+        node->next = nodes->len;
+    }
+    g_array_set_size(stack, depth);
+}
+
+/* Rows below node v while it is expanded. */
+static GArray* rows_under(guint32 v)
+{
+    GArray* rows = g_array_new(FALSE, FALSE, sizeof(guint32));
+    for (guint32 u = v + 1; u < NODE(v)->next; u = NODE(u)->open ? u + 1 : NODE(u)->next)
+        g_array_append_val(rows, u);
+    return rows;
+}
+
+/* (Re)build the tree of the lines in strings. Top nodes are shown, and a
+ * single top directory is expanded down to where the tree forks. */
+void tree_build(void)
+{
+    if (nodes)
+        g_array_free(nodes, TRUE);
+    if (shown)
+        g_array_free(shown, TRUE);
+    nodes   = g_array_new(FALSE, FALSE, sizeof(node_t));
+    shown   = g_array_new(FALSE, FALSE, sizeof(guint32));
+    node_of = g_renew(guint32, node_of, MAX(SL, 1));
+
+    const gchar* sep     = conf.tree_separator;
+    gsize        sep_len = strlen(sep);
+    GArray*      stack   = g_array_new(FALSE, FALSE, sizeof(guint32));
+    for (guint32 i = 0; i < SL; i++)
+    {
+        const gchar* str = get_str(i);
+        gsize        len = record_len(str, get_line_t(i)->string->len);
+        /*a trailing separator names the same path*/
+        if (len > sep_len && memcmp(str + len - sep_len, sep, sep_len) == 0)
+            len -= sep_len;
+        guint depth = 0;
+        for (gsize s = 0; s <= len; depth++)
+        {
+            const gchar* hit  = g_strstr_len(str + s, len - s, sep);
+            gsize        e    = hit ? (gsize)(hit - str) : len;
+            gboolean     leaf = (hit == NULL);
+            if (depth < stack->len)
+            {
+                node_t* node = NODE(g_array_index(stack, guint32, depth));
+                if (node->len == e - s && memcmp(name_of(node), str + s, e - s) == 0
+                    && !(leaf && node->line != NONE))
+                {
+                    s = e + sep_len;
+                    continue;
+                }
+                close_from(stack, depth, i);
+            }
+            node_t node = { i, i, 0, 0, depth ? g_array_index(stack, guint32, depth - 1) : NONE,
+                            NONE, s, e - s, MIN(depth, G_MAXUINT16), FALSE };
+            guint32 v = nodes->len;
+            g_array_append_val(nodes, node);
+            g_array_append_val(stack, v);
+            s = e + sep_len;
+        }
+        close_from(stack, depth, i);
+        guint32 v = g_array_index(stack, guint32, depth - 1);
+        NODE(v)->line = i;
+        node_of[i]    = v;
+        for (guint d = 0; d < depth; d++)
+            NODE(g_array_index(stack, guint32, d))->last = i + 1;
+    }
+    close_from(stack, 0, SL);
+    g_array_free(stack, TRUE);
+
+    /*children come after their parent*/
+    for (guint32 v = nodes->len; v-- > 0; )
+    {
+        node_t* node = NODE(v);
+        if (node->line != NONE && is_checked(node->line))
+            node->checked++;
+        if (node->parent != NONE)
+            NODE(node->parent)->checked += node->checked;
+    }
+
+    for (guint32 v = 0; v < nodes->len; v = NODE(v)->next)
+        g_array_append_val(shown, v);
+    for (glong pos = 0; shown->len == (guint) pos + 1 && tree_expand(pos, TRUE); pos++)
+        ;
+}
+
+glong tree_shown(void)
+{
+    return shown ? shown->len : 0;
+}
+
+/* The line of the row's own path, or -1 for a directory no line names. */
+glong tree_line(glong pos)
+{
+    guint32 line = NODE(SHOWN(pos))->line;
+    return line == NONE ? -1 : (glong) line;
+}
+
+/* The first line under the row. */
+glong tree_first(glong pos)
+{
+    return NODE(SHOWN(pos))->first;
+}
+
+/* Row of a node, which must be shown. */
+static glong pos_of_node(guint32 v)
+{
+    glong lo = 0, hi = shown->len;
+    while (lo < hi)
+    {
+        glong mid = (lo + hi) / 2;
+        if (SHOWN(mid) < v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Expand (or collapse) the directory on row pos. Returns FALSE if there
+ * was nothing to do. */
+gboolean tree_expand(glong pos, gboolean open)
+{
+    guint32 v    = SHOWN(pos);
+    node_t* node = NODE(v);
+    if (!has_children(v) || !node->open == !open)
+        return FALSE;
+    node->open = open;
+    if (open)
+    {
+        GArray* rows = rows_under(v);
+        g_array_insert_vals(shown, pos + 1, rows->data, rows->len);
+        g_array_free(rows, TRUE);
+    }
+    else
+        g_array_remove_range(shown, pos + 1, pos_of_node(node->next) - (pos + 1));
+    return TRUE;
+}
+
+/* Row of the line, expanding the directories above it. */
+glong tree_pos(glong line)
+{
+    if (line < 0 || line >= SL || !nodes)
+        return 0;
+    guint32 v = node_of[line];
+    /*expand from the top, so each splice lands in shown rows*/
+    GArray* path = g_array_new(FALSE, FALSE, sizeof(guint32));
+    for (guint32 u = NODE(v)->parent; u != NONE; u = NODE(u)->parent)
+        g_array_prepend_val(path, u);
+    for (guint k = 0; k < path->len; k++)
+    {
+        guint32 u = g_array_index(path, guint32, k);
+        if (!NODE(u)->open)
+            tree_expand(pos_of_node(u), TRUE);
+    }
+    g_array_free(path, TRUE);
+    return pos_of_node(v);
+}
+
+/* Row of the directory the row is in, or -1 at the top. */
+glong tree_parent(glong pos)
+{
+    guint32 parent = NODE(SHOWN(pos))->parent;
+    return parent == NONE ? -1 : pos_of_node(parent);
+}
+
+/* What the row shows: indentation, a mark for directories, the name. */
+gchar* tree_text(glong pos)
+{
+    guint32  v     = SHOWN(pos);
+    node_t*  node  = NODE(v);
+    gboolean dir   = has_children(v);
+    GString* text  = g_string_sized_new(node->depth * 2 + node->len + 8);
+    for (guint d = 0; d < node->depth; d++)
+        g_string_append(text, "  ");
+    g_string_append(text, !dir ? "  " : node->open ? "- " : "+ ");
+    g_string_append_len(text, name_of(node), node->len);
+    if (dir)
+        g_string_append(text, conf.tree_separator);
+    return g_string_free(text, FALSE);
+}
+
+/* A directory is checked when every line under it is. */
+gboolean tree_checked(glong pos)
+{
+    node_t* node = NODE(SHOWN(pos));
+    return node->last > node->first && node->checked == node->last - node->first;
+}
+
+/* Count the line as (un)checked in the nodes it is under. Called by
+ * set_checked() when its state changes. */
+void tree_set_checked(guint index, gboolean b)
+{
+    if (!nodes || range_setting || index >= SL)
+        return;
+    for (guint32 v = node_of[index]; v != NONE; v = NODE(v)->parent)
+        NODE(v)->checked += b ? 1 : -1;
+}
+
+/* Toggle the line of the row, or every line under a directory, which
+ * are one contiguous range. The range is set in one pass over its flags,
+ * and the counts are fixed once per node, not once per line and level:
+ * the nodes of the subtree are all full or all empty, and the ones above
+ * change by the same amount. */
+void tree_toggle_checked(glong pos)
+{
+    guint32 v    = SHOWN(pos);
+    node_t* node = NODE(v);
+    if (!has_children(v))
+    {
+        toggle_checked(node->line);
+        return;
+    }
+    if (conf.radiobox)
+        return;
+    gboolean state = !tree_checked(pos);
+    range_setting  = TRUE;
+    for (guint32 i = node->first; i < node->last; i++)
+        set_checked(i, state);
+    range_setting  = FALSE;
+
+    gint64 delta = (gint64)(state ? node->last - node->first : 0) - node->checked;
+    for (guint32 u = v; u < node->next; u++)
+        NODE(u)->checked = state ? NODE(u)->last - NODE(u)->first : 0;
+    for (guint32 u = node->parent; u != NONE; u = NODE(u)->parent)
+        NODE(u)->checked += delta;
+}
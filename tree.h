@@ -0,0 +1,16 @@
+#pragma once
+
+#include "conf.h"
+
+void     tree_init(void);
+void     tree_build(void);
+glong    tree_shown(void);
+glong    tree_line(glong);
+glong    tree_first(glong);
+glong    tree_pos(glong);
+glong    tree_parent(glong);
+gchar*   tree_text(glong);
+gboolean tree_checked(glong);
+void     tree_set_checked(guint, gboolean);
+void     tree_toggle_checked(glong);
+gboolean tree_expand(glong, gboolean);
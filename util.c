@@ -38,62 +38,199 @@ void _warn(gint line, const gchar *fct, const gchar *fmt, ...)
 
 #include <string.h>
 #include <wchar.h>
+
+guint16 width_stage1[WIDTH_BLOCKS];
+guint8  width_stage2[WIDTH_BLOCKS][64];
+static guint  width_stage2_len;
+static GMutex width_lock;
+
+guint unichar_width_classify(gunichar x)
+{
+    if (g_unichar_iswide(x))
+        return 2;
+    else if (g_unichar_iszerowidth(x))
+        return 0;
+    else if (g_unichar_iscntrl(x))
+        return 2;
+    else
+        return 1;
+}
+
+/* Classify a whole block once and share it with any identical block seen
+ * before, so the table stays small (most blocks are all 1 or all 2).
+ * Readers may run in other threads: a block is published in stage 1 only
+ * after its stage 2 entry is complete, and stage 2 never moves. */
+guint16 width_block_build(guint block)
+{
+    guint8 packed[64] = {0};
+    gunichar base = block << WIDTH_BLOCK_SHIFT;
+    for (guint i = 0; i < 256; i++)
+        packed[i >> 2] |= unichar_width_classify(base + i) << ((i & 3) * 2);
+
+    g_mutex_lock(&width_lock);
+    guint16 found = width_stage1[block];
+    for (guint i = 0; i < width_stage2_len && !found; i++)
+        if (memcmp(width_stage2[i], packed, sizeof(packed)) == 0)
+            found = i + 1;
+    if (!found)
+    {
+        memcpy(width_stage2[width_stage2_len], packed, sizeof(packed));
+        found = ++width_stage2_len;
+    }
+    __atomic_store_n(&width_stage1[block], found, __ATOMIC_RELEASE);
+    g_mutex_unlock(&width_lock);
+    return found;
+}
+
+/* Eight bytes of printable ASCII, each one column wide. */
+inline static gboolean is_printable_ascii8(const gchar* p)
+{
+    const guint64 ones = 0x0101010101010101ull;
+    const guint64 high = ones * 0x80;
+    guint64 x;
+    memcpy(&x, p, sizeof(x));
+    guint64 below = (x - ones * 0x20) & ~x & high;
+    guint64 above = ((x + ones) | x) & high;
+    return !(below | above);
+}
+
 glong g_utf8_strwidth(char* p)
 {
     gunichar c;
     glong width = 0;
-    while (*p)
+    const gchar* end = p + strlen(p);
+    while (p < end)
     {
-        c = get_unichar(p);
+        while (end - p >= 8 && is_printable_ascii8(p))
+        {
+            width += 8;
+            p += 8;
+        }
+        if (p >= end)
+            break;
+        guint n = utf8_decode(p, &c);
         if (is_separator(c))
             break;
         width += gunichar_width(c);
-        p = g_utf8_next_char(p);
+        p += n;
     }
     return width;
 }
 
-gchar* g_utf8_substring_by_width(gchar* str, glong start_width, glong finish_width)
+/* Scan from a known (byte offset, width) position of str. Both bounds
+ * must lie at or after that position. */
+static gchar* substring_by_width_from(gchar* str, gsize offset, glong w, glong start_width, glong finish_width)
 {
     gunichar c;
-    glong length = 0;
-    glong start  = 0;
-    glong finish = 0;
-    glong w = 0;
-    gchar* p = str;
+    gsize start  = offset;
+    gsize finish = offset;
+    gchar* p = str + offset;
     while (*p)
     {
-        c = get_unichar(p);
+        gsize prev = p - str;
+        p += utf8_decode(p, &c);
         glong width = gunichar_width(c);
         w += width;
-        p = g_utf8_next_char(p);
-        length++;
 
         if (w == start_width)
-            start = length;
+            start = p - str;
         else if (w == start_width + 1 && width == 2)
-            start = length - 1;
-        if (w == finish_width)
+            start = prev;
+        if (w == finish_width || (w == finish_width + 1 && width == 2))
         {
-            finish = length;
+            finish = p - str;
             break;
         }
-        else if (w == finish_width + 1 && width == 2)
-        {
-            finish = length;
+    }
+    if (finish < start)
+        finish = start;
+    return g_strndup(str + start, finish - start);
+}
+
+gchar* g_utf8_substring_by_width(gchar* str, glong start_width, glong finish_width)
+{
+    return substring_by_width_from(str, 0, 0, start_width, finish_width);
+}
+
+/* Sparse (byte offset, width) index of a long line, a mark roughly every
+ * CHECKPOINT_STEP columns. Built on first horizontal access. */
+#define CHECKPOINT_STEP 256
+
+typedef struct
+{
+    gsize offset;
+    glong width;
+} checkpoint_t;
+
+static GArray* build_checkpoints(gchar* str)
+{
+    GArray* marks = g_array_new(FALSE, FALSE, sizeof(checkpoint_t));
+    checkpoint_t mark = {0, 0};
+    g_array_append_val(marks, mark);
+    gunichar c;
+    glong w    = 0;
+    glong next = CHECKPOINT_STEP;
+    gchar* p = str;
+    while (*p)
+    {
+        p += utf8_decode(p, &c);
+        if (is_separator(c))
             break;
+        w += gunichar_width(c);
+        if (w >= next)
+        {
+            mark.offset = p - str;
+            mark.width  = w;
+            g_array_append_val(marks, mark);
+            next = w + CHECKPOINT_STEP;
         }
     }
-    if (finish < start)
-        finish = start = 0;
-    return g_utf8_substring(str, start, finish);
+    return marks;
+}
+
+/* Last checkpoint strictly before width, so that a scan from it sees
+ * every character that can start or end the requested slice. */
+static checkpoint_t* find_checkpoint(GArray* marks, glong width)
+{
+    guint lo = 0;
+    guint hi = marks->len;
+    while (hi - lo > 1)
+    {
+        guint mid = (lo + hi) / 2;
+        if (g_array_index(marks, checkpoint_t, mid).width < width)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return &g_array_index(marks, checkpoint_t, lo);
 }
 
 gchar* get_utf8_substring_by_width(guint index, glong start_width, glong finish_width)
 {
-    gchar* str = get_str(index);
-    if (width_is_length(index))
-        return g_utf8_substring(str, start_width, finish_width);
-    else
+    line_t* line = get_line_t(index);
+    gchar*  str  = line->string->str;
+    if (conf.raw)
+    {
+        glong start  = CLAMP(start_width, 0, line->width);
+        glong finish = CLAMP(finish_width, start, line->width);
+        /*not g_strndup(), NUL bytes are data here*/
+        gchar* slice = g_malloc(finish - start + 1);
+        memcpy(slice, str + start, finish - start);
+        slice[finish - start] = '\0';
+        return slice;
+    }
+    if (line->size == line->length && width_is_length(index))
+    {
+        /*ASCII, one byte a column: slice in place*/
+        glong start  = CLAMP(start_width, 0, line->width);
+        glong finish = CLAMP(finish_width, start, line->width);
+        return g_strndup(str + start, finish - start);
+    }
+    if (line->width <= 2 * CHECKPOINT_STEP || finish_width < start_width)
         return g_utf8_substring_by_width(str, start_width, finish_width);
+
+    if (!line->checkpoints)
+        line->checkpoints = build_checkpoints(str);
+    checkpoint_t* mark = find_checkpoint(line->checkpoints, start_width);
+    return substring_by_width_from(str, mark->offset, mark->width, start_width, finish_width);
 }
@@ -1,5 +1,8 @@
 #pragma once
 #include "conf.h"
+#include "output.h"
+#include "selection.h"
+#include "tree.h"
 
 /* ANSI term color codes */
 #define ANSI_COLOR_RESET   "\x1b[0m"
@@ -42,30 +45,99 @@ static inline gboolean is_name(const gchar* name, const gchar* name_compare)
     return (g_strcmp0(name, name_compare) == 0);
 }
 
+/* Two-stage width table: stage 1 maps a block of 256 code points to a
+ * stage 2 block of packed 2-bit widths. See util.c. */
+#define WIDTH_BLOCK_SHIFT 8
+#define WIDTH_BLOCKS      (0x110000u >> WIDTH_BLOCK_SHIFT)
+
+extern guint16 width_stage1[WIDTH_BLOCKS];
+extern guint8  width_stage2[WIDTH_BLOCKS][64];
+guint16 width_block_build(guint);
+guint   unichar_width_classify(gunichar);
+
 inline static guint gunichar_width(gunichar x)
 {
-    if (g_unichar_iswide(x))
-        return 2;
-    else if (g_unichar_iszerowidth(x))
-        return 0;
-    else if (g_unichar_iscntrl(x))
-        return 2;
+    if (G_UNLIKELY(x >= 0x110000))
+        return unichar_width_classify(x);
+    guint16 block = __atomic_load_n(&width_stage1[x >> WIDTH_BLOCK_SHIFT], __ATOMIC_ACQUIRE);
+    if (G_UNLIKELY(block == 0))
+        block = width_block_build(x >> WIDTH_BLOCK_SHIFT);
+    guint8 packed = width_stage2[block - 1][(x & 0xff) >> 2];
+    return (packed >> ((x & 3) * 2)) & 3;
+}
+
+/* Decode one character at s, substituting tab, vertical tab and invalid
+ * sequences for display. Returns the number of bytes to skip, which is
+ * always what g_utf8_next_char() would skip. */
+inline static guint utf8_decode(const gchar* s, gunichar* out)
+{
+    const guchar* u = (const guchar*) s;
+    guint len = g_utf8_skip[u[0]];
+    gunichar c;
+    if (u[0] < 0x80)
+        c = u[0];
+    else if (len == 2 && u[0] >= 0xc0 && (u[1] & 0xc0) == 0x80)
+    {
+        c = ((u[0] & 0x1f) << 6) | (u[1] & 0x3f);
+        if (c < 0x80)
+            c = (gunichar)(-1);
+    }
+    else if (len == 3 && (u[1] & 0xc0) == 0x80 && (u[2] & 0xc0) == 0x80)
+    {
+        c = ((u[0] & 0x0f) << 12) | ((u[1] & 0x3f) << 6) | (u[2] & 0x3f);
+        if (c < 0x800 || (c >= 0xd800 && c < 0xe000))
+            c = (gunichar)(-1);
+    }
+    else if (len == 4 && (u[1] & 0xc0) == 0x80 && (u[2] & 0xc0) == 0x80 && (u[3] & 0xc0) == 0x80)
+    {
+        c = ((u[0] & 0x07) << 18) | ((u[1] & 0x3f) << 12) | ((u[2] & 0x3f) << 6) | (u[3] & 0x3f);
+        if (c < 0x10000 || c > 0x10ffff)
+            c = (gunichar)(-1);
+    }
     else
-        return 1;
-}
+        c = (gunichar)(-1);
 
-inline static gunichar get_unichar(gchar* s)
-{
-    gunichar c = g_utf8_get_char_validated(s, -1);
     if (c == 0x0009) //tab
         c = 0x2409;
     if (c == 0x000b) //vertical tab
         c = 0x240b;
-    else if (c == (gunichar)(-2) ||c == (gunichar)(-1))
+    else if (c == (gunichar)(-1))
         c = ' ';
+    *out = c;
+    return len;
+}
+
+inline static gunichar get_unichar(gchar* s)
+{
+    gunichar c;
+    utf8_decode(s, &c);
     return c;
 }
 
+/* Glyph a byte is shown as in --raw mode, always one column wide:
+ * control bytes as control pictures, bytes above 0x7f as U+FFFD. */
+inline static gunichar raw_glyph(gchar b)
+{
+    guchar u = (guchar) b;
+    if (u < 0x20)
+        return 0x2400 + u;
+    if (u == 0x7f)
+        return 0x2421;
+    if (u > 0x7f)
+        return 0xfffd;
+    return u;
+}
+
+/* Length of a record without its terminator. */
+inline static gsize record_len(const gchar* s, gsize len)
+{
+    if (len > 0 && s[len - 1] == conf.delimiter)
+        len--;
+    if (conf.delimiter == '\n' && len > 0 && s[len - 1] == '\r')
+        len--;
+    return len;
+}
+
 inline static gboolean has_character(const gchar* str)
 {
     return (str && g_utf8_validate(str, -1, NULL) && g_utf8_strlen(str, -1) > 0);
@@ -118,7 +190,15 @@ inline static gboolean is_checked(guint index)
 
 inline static void set_checked(guint index, gboolean b)
 {
-    get_line_t(index)->checked = b;
+    line_t* line = get_line_t(index);
+    if (!line->checked != !b)
+    {
+        if (conf.stream)
+            stream_line(index, b);
+        selection_set(index, b);
+        tree_set_checked(index, b);
+    }
+    line->checked = b;
 }
 
 inline static void uncheck_all()
@@ -127,17 +207,17 @@ inline static void uncheck_all()
         set_checked(i, false);
 }
 
-inline static void check_all()
+inline static void check_all(glong current)
 {
     if (!conf.radiobox)
     {
         for (glong i = 0; i < SL; i++)
             set_checked(i, true);
     }
-    else
+    else if (current >= 0)
     {
         uncheck_all();
-        set_checked(view.current, TRUE);
+        set_checked(current, TRUE);
     }
 }
 
@@ -150,14 +230,14 @@ inline static void toggle_all()
     }
 }
 
-inline static void toggle_radiobox()
+inline static void toggle_radiobox(glong current)
 {
     if (!conf.radiobox)
     {
-        if (is_checked(view.current))
+        if (current >= 0 && is_checked(current))
         {
             uncheck_all();
-            set_checked(view.current, TRUE);
+            set_checked(current, TRUE);
         }
         else
             uncheck_all();
@@ -0,0 +1,102 @@
+#include "wrap.h"
+
+/*
+ * Row index of the wrapped view. A line of width w takes
+ * ceil(w / cols) screen rows, at least one. The heights are kept in a
+ * Fenwick tree, so the first row of a line and the line on a row are
+ * found in O(log N), and lines appended by --follow are added in
+ * O(log N) without rebuilding. A change of cols rebuilds it in O(N).
+ */
+
+/*tree[i] is the sum of the heights of lines (i - lowbit(i), i], 1-based*/
+static glong* tree;
+static glong  n;
+static glong  capacity;
+static glong  cols = 1;
+static glong  total;
+static wrap_width_fn width_of;
+
+#define lowbit(i) ((i) & -(i))
+
+glong wrap_height(glong index)
+{
+    glong width = width_of(index);
+    return width <= cols ? 1 : (width + cols - 1) / cols;
+}
+
+static void reserve(glong size)
+{
+    if (size < capacity)
+        return;
+    capacity = MAX(size + 1, capacity * 2);
+    tree = g_renew(glong, tree, capacity);
+}
+
+/* Index count lines, each row cols columns wide. */
+void wrap_build(glong count, glong width, wrap_width_fn fn)
+{
+    width_of = fn;
+    cols     = MAX(1, width);
+    n        = count;
+    total    = 0;
+    reserve(n);
+    for (glong i = 1; i <= n; i++)
+    {
+        tree[i] = wrap_height(i - 1);
+        total  += tree[i];
+    }
+    for (glong i = 1; i <= n; i++)
+    {
+        glong parent = i + lowbit(i);
+        if (parent <= n)
+            tree[parent] += tree[i];
+    }
+}
+
+/* Index the lines appended since the last call, up to count. */
+void wrap_append(glong count)
+{
+    reserve(count);
+    for (glong i = n + 1; i <= count; i++)
+    {
+        glong h = wrap_height(i - 1);
+        /*the children of node i are i - 1, i - 2, i - 4, ... below lowbit(i)*/
+        tree[i] = h;
+        for (glong k = 1; k < lowbit(i); k <<= 1)
+            tree[i] += tree[i - k];
+        total += h;
+        n = i;
+    }
+}
+
+/* First row of the line at index. */
+glong wrap_row(glong index)
+{
+    glong row = 0;
+    for (glong i = MIN(index, n); i > 0; i -= lowbit(i))
+        row += tree[i];
+    return row;
+}
+
+glong wrap_rows(void)
+{
+    return total;
+}
+
+/* The line the row belongs to. */
+glong wrap_line_at(glong row)
+{
+    glong pos = 0;
+    glong step = 1;
+    while (step <= n / 2)
+        step <<= 1;
+    for (; step > 0; step >>= 1)
+    {
+        if (pos + step <= n && tree[pos + step] <= row)
+        {
+            pos += step;
+            row -= tree[pos];
+        }
+    }
+    return MIN(pos, MAX(n - 1, 0));
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "conf.h"
+
+/*width of the line at an index*/
+typedef glong (*wrap_width_fn)(glong);
+
+void  wrap_build(glong, glong, wrap_width_fn);
+void  wrap_append(glong);
+glong wrap_height(glong);
+glong wrap_row(glong);
+glong wrap_rows(void);
+glong wrap_line_at(glong);